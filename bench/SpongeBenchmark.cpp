@@ -0,0 +1,749 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <set>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../headers/DragPredictor.h"
+#include "../headers/LatticeKernel.h"
+#include "../headers/Mailbox.h"
+#include "../headers/MeshletCuller.h"
+#include "../headers/SpongeGenerator.h"
+
+using namespace std;
+
+static atomic<uint64_t> heapAllocations(0);
+
+/**
+ * Count every heap allocation made by the program
+ */
+void *operator new(size_t size) {
+    ++heapAllocations;
+    void *pointer = malloc(size ? size : 1);
+    if (pointer == nullptr) throw bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+/**
+ * Measures a computation in milliseconds and heap allocations
+ */
+struct Measure {
+    double milliseconds;
+    uint64_t allocations;
+};
+
+template<typename F>
+static Measure measure(F computation) {
+    uint64_t allocations = heapAllocations;
+    auto start = chrono::steady_clock::now();
+    computation();
+    auto end = chrono::steady_clock::now();
+    return {chrono::duration<double, milli>(end - start).count(), heapAllocations - allocations};
+}
+
+static const vector<float> cube = {
+        -1.0f, -1.0f, -1.0f,  1.0f, -1.0f, -1.0f,  -1.0f, 1.0f, -1.0f,  1.0f, 1.0f, -1.0f,
+        -1.0f, -1.0f,  1.0f,  1.0f, -1.0f,  1.0f,  -1.0f, 1.0f,  1.0f,  1.0f, 1.0f,  1.0f,
+};
+
+/**
+ * Generate the sponge of a unit cube for depths 1 to 4 on a single thread and report the wall time and heap
+ * allocations of each step.
+ * Every depth is computed twice with the same vectors, the second run shows the steady state of a worker that
+ * regenerates a cell it already built once.
+ */
+static void benchmarkSubdivision() {
+    Sponge sponge;
+    Arena arena;
+    PointArrays vertices, normals;
+    vector<uint32_t> indices;
+
+    cout << "depth  run   subdivide (ms / allocs)   duplicate (ms / allocs)   normals (ms / allocs)" << endl;
+    for (uint8_t depth = 1; depth <= 4; ++depth) {
+        for (uint8_t run = 0; run < 2; ++run) {
+            vertices.clear();
+            indices.clear();
+            normals.clear();
+            Measure subdivision = measure([&]() { sponge.subdivide(depth, cube, vertices, indices, arena); });
+            Measure duplication = measure([&]() { Sponge::duplicateVertices(vertices, indices, arena); });
+            Measure normalization = measure([&]() { Sponge::computeSpongeNormals(vertices, indices, normals); });
+
+            cout << setw(5) << (int) depth << setw(5) << (run == 0 ? "cold" : "warm") << fixed << setprecision(1)
+                 << setw(16) << subdivision.milliseconds << " / " << setw(7) << subdivision.allocations
+                 << setw(16) << duplication.milliseconds << " / " << setw(7) << duplication.allocations
+                 << setw(14) << normalization.milliseconds << " / " << setw(7) << normalization.allocations
+                 << endl;
+        }
+    }
+}
+
+/**
+ * Evaluate the lattices of distorted cubes with every instruction set the CPU supports and report the leaves
+ * evaluated per second and the largest difference to the scalar path
+ */
+static void benchmarkLatticeKernel() {
+    const uint32_t shapes = 1024, leaves = 4000000;
+    vector<float> corners(24 * shapes);
+    for (uint32_t shape = 0; shape < shapes; ++shape) {
+        for (uint32_t coordinate = 0; coordinate < 24; ++coordinate) {
+            corners[24 * shape + coordinate] = cube[coordinate] + (float) ((shape * 31 + coordinate * 17) % 97) / 97.0f;
+        }
+    }
+    vector<float> reference(192 * shapes), points(192 * shapes);
+    LatticeKernel::Path detectedPath = LatticeKernel::getPath();
+    LatticeKernel::setPath(LatticeKernel::SCALAR);
+    for (uint32_t shape = 0; shape < shapes; ++shape) {
+        float *shapeReference = &reference[192 * shape];
+        LatticeKernel::evaluate(&corners[24 * shape], shapeReference, shapeReference + 64, shapeReference + 128);
+    }
+
+    cout << "kernel   M leaves/s   max difference" << endl;
+    for (uint8_t path = 0; path < LatticeKernel::PATH_COUNT; ++path) {
+        if (!LatticeKernel::isSupported((LatticeKernel::Path) path)) continue;
+        LatticeKernel::setPath((LatticeKernel::Path) path);
+        Measure evaluation = measure([&]() {
+            for (uint32_t leaf = 0; leaf < leaves; ++leaf) {
+                float *shapePoints = &points[192 * (leaf % shapes)];
+                LatticeKernel::evaluate(&corners[24 * (leaf % shapes)], shapePoints, shapePoints + 64,
+                                        shapePoints + 128);
+            }
+        });
+        float difference = 0.0f;
+        for (uint32_t coordinate = 0; coordinate < points.size(); ++coordinate) {
+            difference = max(difference, fabs(points[coordinate] - reference[coordinate]));
+        }
+        cout << setw(6) << LatticeKernel::getPathName((LatticeKernel::Path) path) << fixed << setprecision(1)
+             << setw(13) << leaves / evaluation.milliseconds / 1000.0 << scientific << setprecision(1)
+             << setw(17) << difference << defaultfloat << endl;
+    }
+    LatticeKernel::setPath(detectedPath);
+}
+
+/**
+ * Generate the 8 cubes of the hypercube at depth 3 with an increasing number of threads, the way
+ * Window::computeVertexArray does, and report the wall time and speedup over a single thread
+ * @param maxThreads is the largest number of threads to try
+ */
+static void benchmarkThreadScaling(uint32_t maxThreads) {
+    const uint8_t depth = 3;
+    const uint8_t cells = 8;
+    vector<float> parallelepipeds[cells];
+    PointArrays vertices[cells], normals[cells];
+    vector<uint32_t> indices[cells];
+    for (uint8_t cell = 0; cell < cells; ++cell) {
+        parallelepipeds[cell] = cube;
+        for (uint8_t i = 0; i < cube.size(); i += 3) {
+            parallelepipeds[cell][i] += 3.0f * (float) cell;
+        }
+    }
+
+    vector<uint32_t> threadCounts;
+    for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    cout << endl << "threads   generate 8 cells at depth " << (int) depth << " (ms)   speedup" << endl;
+    double singleThreadMilliseconds = 0.0;
+    for (uint32_t threads : threadCounts) {
+        SpongeGenerator generator(threads);
+        /* The first run warms the buffers up, the best of the following ones is kept */
+        double best = 1e30;
+        for (uint8_t run = 0; run < 4; ++run) {
+            Measure generation = measure([&]() {
+                generator.generate(depth, parallelepipeds, cells, vertices, indices, normals);
+            });
+            if (run > 0) {
+                best = min(best, generation.milliseconds);
+            }
+        }
+        if (threads == 1) {
+            singleThreadMilliseconds = best;
+        }
+        cout << setw(7) << threads << fixed << setprecision(1) << setw(32) << best
+             << setw(10) << setprecision(2) << singleThreadMilliseconds / best << endl;
+    }
+}
+
+/**
+ * Compare what a rotation costs when the 8 cubes of the hypercube are generated again at depth 3, the way
+ * Window::updateRotations used to do it, with projecting a cell sponge generated once in cell space
+ * @param threads is the number of threads to use
+ */
+static void benchmarkReprojection(uint32_t threads) {
+    const uint8_t depth = 3;
+    const uint8_t cells = 8;
+    const float cameraOffset4D = 3.0f;
+    vector<float> parallelepipeds[cells];
+    PointArrays vertices[cells], normals[cells];
+    vector<uint32_t> indices[cells];
+    glm::vec4 corners[cells * 8];
+    for (uint8_t cell = 0; cell < cells; ++cell) {
+        for (uint8_t corner = 0; corner < 8; ++corner) {
+            /* Cells leaning along W so that the perspective division isn't trivial */
+            glm::vec4 point(cube[3 * corner] + 3.0f * (float) cell, cube[3 * corner + 1], cube[3 * corner + 2],
+                            0.25f * cube[3 * corner] - 1.0f);
+            corners[8 * cell + corner] = point;
+            glm::vec3 projected = glm::vec3(point) / (cameraOffset4D - point.w);
+            parallelepipeds[cell].insert(parallelepipeds[cell].end(), {projected.x, projected.y, projected.z});
+        }
+    }
+
+    SpongeGenerator generator(threads);
+    CellSponge cellSponge;
+    Measure cellSpongeGeneration = measure([&]() {
+        generator.generateCellSponge(depth, cellSponge, CancellationToken());
+    });
+    double regeneration = 1e30, reprojection = 1e30;
+    for (uint8_t run = 0; run < 4; ++run) {
+        Measure generation = measure([&]() {
+            generator.generate(depth, parallelepipeds, cells, vertices, indices, normals);
+        });
+        Measure projection = measure([&]() {
+            generator.project(cellSponge, corners, cells, cameraOffset4D, vertices, normals);
+        });
+        /* The first run warms the buffers up */
+        if (run > 0) {
+            regeneration = min(regeneration, generation.milliseconds);
+            reprojection = min(reprojection, projection.milliseconds);
+        }
+    }
+
+    cout << endl << "rotation of 8 cells at depth " << (int) depth << " on " << threads << " threads" << endl
+         << fixed << setprecision(1)
+         << "  cell sponge generation (once per depth) " << setw(8) << cellSpongeGeneration.milliseconds << " ms"
+         << endl
+         << "  regenerate every cell                   " << setw(8) << regeneration << " ms" << endl
+         << "  project the cell sponge                 " << setw(8) << reprojection << " ms" << endl;
+}
+
+/**
+ * Split what displaying a rotation costs for one cell at depth 3 on a single thread into its stages: projecting the
+ * cell sponge with its normals, and interleaving the coordinates of the vertices and normals into the layout of the
+ * GPU buffers when they are uploaded. The projection gives the normals from the face orientations, they are compared
+ * with the separate pass over the faces it replaced, and with the flat shading which needs neither computing nor
+ * uploading them
+ */
+static void benchmarkMeshStages() {
+    const uint8_t depth = 3;
+    const float cameraOffset4D = 3.0f;
+    glm::vec4 corners[8];
+    for (uint8_t corner = 0; corner < 8; ++corner) {
+        corners[corner] = glm::vec4(cube[3 * corner], cube[3 * corner + 1], cube[3 * corner + 2],
+                                    0.25f * cube[3 * corner] - 1.0f);
+    }
+
+    SpongeGenerator generator(1);
+    CellSponge cellSponge;
+    generator.generateCellSponge(depth, cellSponge, CancellationToken());
+    /* The separate pass takes indices into the whole mesh */
+    vector<uint32_t> meshIndices;
+    for (const IndexBatch &batch : cellSponge.batches) {
+        for (uint32_t index = batch.firstIndex; index < batch.firstIndex + batch.indexCount; ++index) {
+            meshIndices.push_back(batch.firstVertex + cellSponge.indices[index]);
+        }
+    }
+    PointArrays vertices[1], normals[1];
+    vector<float> uploaded;
+    double projection = 1e30, normalization = 1e30, interleaving = 1e30;
+    double flatProjection = 1e30, flatInterleaving = 1e30;
+    for (uint8_t run = 0; run < 4; ++run) {
+        Measure projected = measure([&]() {
+            generator.project(cellSponge, corners, 1, cameraOffset4D, vertices, normals);
+        });
+        Measure normalized = measure([&]() {
+            Sponge::computeSpongeNormals(vertices[0], meshIndices, normals[0]);
+        });
+        uploaded.resize(3 * vertices[0].size());
+        Measure interleaved = measure([&]() {
+            vertices[0].interleave(uploaded.data());
+            normals[0].interleave(uploaded.data());
+        });
+        Measure flatProjected = measure([&]() {
+            generator.project(cellSponge, corners, 1, cameraOffset4D, vertices, nullptr);
+        });
+        Measure flatInterleaved = measure([&]() {
+            vertices[0].interleave(uploaded.data());
+        });
+        /* The first run warms the buffers up */
+        if (run > 0) {
+            projection = min(projection, projected.milliseconds);
+            normalization = min(normalization, normalized.milliseconds);
+            interleaving = min(interleaving, interleaved.milliseconds);
+            flatProjection = min(flatProjection, flatProjected.milliseconds);
+            flatInterleaving = min(flatInterleaving, flatInterleaved.milliseconds);
+        }
+    }
+
+    cout << endl << "stages of a rotation for 1 cell of " << vertices[0].size() << " vertices at depth " << (int) depth
+         << endl << fixed << setprecision(2)
+         << "  project with normals        " << setw(8) << projection << " ms" << endl
+         << "  normals in a separate pass  " << setw(8) << normalization << " ms" << endl
+         << "  interleave for the upload   " << setw(8) << interleaving << " ms" << endl
+         << "  project flat shaded         " << setw(8) << flatProjection << " ms" << endl
+         << "  interleave flat shaded      " << setw(8) << flatInterleaving << " ms" << endl;
+}
+
+/**
+ * Count the pairs of quads that cover the same rectangle of the lattice from opposite sides. Both would lie inside the
+ * sponge and never be seen
+ * @param lattice is a vector containing lattice coordinates
+ * @param indices is a vector containing indices that describe quads, 6 indices each
+ * @return the number of pairs
+ */
+static uint64_t countCoincidentFaces(const vector<uint16_t> &lattice, const vector<uint32_t> &indices) {
+    /* Each quad is given by its bounds, the axis it faces and its side, so that coincident quads end up consecutive
+     * once sorted */
+    vector<array<uint16_t, 8>> quads;
+    for (uint64_t quad = 0; quad < indices.size(); quad += 6) {
+        array<uint16_t, 8> key = {};
+        fill(key.begin() + 1, key.begin() + 4, UINT16_MAX);
+        for (uint8_t i = 0; i < 6; ++i) {
+            const uint16_t *point = &lattice[3 * indices[quad + i]];
+            for (uint8_t axis = 0; axis < 3; ++axis) {
+                key[1 + axis] = min(key[1 + axis], point[axis]);
+                key[4 + axis] = max(key[4 + axis], point[axis]);
+            }
+        }
+        const uint16_t *a = &lattice[3 * indices[quad]];
+        const uint16_t *b = &lattice[3 * indices[quad + 1]];
+        const uint16_t *c = &lattice[3 * indices[quad + 2]];
+        int32_t U[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]}, V[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        int32_t normal[3] = {U[1] * V[2] - U[2] * V[1], U[2] * V[0] - U[0] * V[2], U[0] * V[1] - U[1] * V[0]};
+        uint8_t axis = normal[0] != 0 ? 0 : (normal[1] != 0 ? 1 : 2);
+        key[0] = axis;
+        key[7] = normal[axis] < 0;
+        quads.push_back(key);
+    }
+    sort(quads.begin(), quads.end());
+
+    uint64_t pairs = 0;
+    for (uint64_t quad = 0; quad + 1 < quads.size(); ++quad) {
+        if (equal(quads[quad].begin(), quads[quad].begin() + 7, quads[quad + 1].begin()) &&
+            quads[quad][7] != quads[quad + 1][7]) {
+            ++pairs;
+            ++quad;
+        }
+    }
+    return pairs;
+}
+
+/**
+ * Look for the coincident quads of the cell sponge at depths 0 to 4: the subdivision never writes a face between two
+ * kept cubes, so there should be none and no pass removing them is worth running
+ */
+static void benchmarkCoincidentFaces() {
+    Sponge sponge;
+    vector<uint16_t> lattice;
+    vector<uint32_t> indices;
+
+    cout << endl << "depth       quads   coincident pairs   time (ms)" << endl;
+    for (uint8_t depth = 0; depth <= 4; ++depth) {
+        sponge.subdivideLattice(depth, lattice, indices);
+        uint64_t pairs = 0;
+        Measure search = measure([&]() { pairs = countCoincidentFaces(lattice, indices); });
+
+        cout << setw(5) << (int) depth << setw(12) << indices.size() / 6 << setw(19) << pairs << fixed
+             << setprecision(1) << setw(12) << search.milliseconds << endl;
+    }
+}
+
+/**
+ * Merge the coplanar quads of the cell sponge at depths 0 to 4 and report the triangles left and the cost of the
+ * merge
+ */
+static void benchmarkFaceMerging() {
+    Sponge sponge;
+    Arena arena;
+    vector<uint16_t> lattice;
+    vector<uint32_t> indices;
+
+    cout << endl << "depth   triangles   merged triangles   reduction   time (ms)" << endl;
+    for (uint8_t depth = 0; depth <= 4; ++depth) {
+        sponge.subdivideLattice(depth, lattice, indices);
+        uint64_t triangles = indices.size() / 3;
+        Measure merge = measure([&]() {
+            Sponge::mergeCoplanarFaces(lattice, indices, Sponge::getLatticeSize(depth), arena, CancellationToken());
+        });
+
+        cout << setw(5) << (int) depth << setw(12) << triangles << setw(19) << indices.size() / 3 << fixed
+             << setprecision(2) << setw(11) << (double) triangles / (indices.size() / 3) << setprecision(1)
+             << setw(12) << merge.milliseconds << endl;
+    }
+}
+
+/**
+ * Weld the merged cell sponge at depths 0 to 4 into batches of 16 bit indices and report what the GPU receives for a
+ * cube, compared with a single batch of 32 bit indices. The lattice points a batch shares with the previous ones are
+ * counted as duplicates
+ */
+static void benchmarkIndexBatches() {
+    Sponge sponge;
+    Arena arena;
+    vector<uint16_t> lattice, weldedVertices, weldedIndices;
+    vector<uint32_t> indices;
+    vector<IndexBatch> batches;
+
+    cout << endl << "depth    vertices  duplicates  batches   32 bit upload (kB)   16 bit upload (kB)   weld (ms)"
+         << endl;
+    for (uint8_t depth = 0; depth <= 4; ++depth) {
+        sponge.subdivideLattice(depth, lattice, indices);
+        Sponge::mergeCoplanarFaces(lattice, indices, Sponge::getLatticeSize(depth), arena, CancellationToken());
+        Measure weld = measure([&]() {
+            Sponge::weldVertices(lattice, indices, weldedVertices, weldedIndices, batches, arena, CancellationToken());
+        });
+
+        /* Vertices are 4 unsigned shorts, welded once per lattice point and orientation without batches */
+        uint64_t vertexCount = weldedVertices.size() / 4;
+        vector<uint64_t> keys(vertexCount);
+        for (uint64_t vertex = 0; vertex < vertexCount; ++vertex) {
+            const uint16_t *value = &weldedVertices[4 * vertex];
+            keys[vertex] = value[3] | (uint64_t) value[0] << 3u | (uint64_t) value[1] << 18u |
+                           (uint64_t) value[2] << 33u;
+        }
+        sort(keys.begin(), keys.end());
+        uint64_t uniqueCount = unique(keys.begin(), keys.end()) - keys.begin();
+        uint64_t wideBytes = uniqueCount * 4 * sizeof(uint16_t) + weldedIndices.size() * sizeof(uint32_t);
+        uint64_t narrowBytes = vertexCount * 4 * sizeof(uint16_t) + weldedIndices.size() * sizeof(uint16_t);
+
+        cout << setw(5) << (int) depth << setw(12) << vertexCount << setw(12) << vertexCount - uniqueCount
+             << setw(9) << batches.size() << fixed << setprecision(0) << setw(21) << wideBytes / 1024.0
+             << setw(21) << narrowBytes / 1024.0 << setprecision(1) << setw(12) << weld.milliseconds << endl;
+    }
+}
+
+/**
+ * Reorder the triangles of the welded cell sponge at depths 1 to 4 for the post-transform cache, and report the
+ * average cache miss ratio of a first in first out cache of 16 and 32 vertices before and after. No order does better
+ * than transforming each vertex once. The weld is timed for comparison: both run on the worker after every generation,
+ * the reordering of a cell sponge being shared by the threads
+ */
+static void benchmarkVertexCache() {
+    Sponge sponge;
+    Arena arena;
+    vector<uint16_t> lattice, weldedVertices, weldedIndices;
+    vector<uint32_t> indices;
+    vector<IndexBatch> batches;
+
+    cout << endl << "depth   triangles   ACMR 16 before   after   ACMR 32 before   after   best"
+         << "   weld (ms)   reorder (ms)" << endl;
+    for (uint8_t depth = 1; depth <= 4; ++depth) {
+        sponge.subdivideLattice(depth, lattice, indices);
+        Sponge::mergeCoplanarFaces(lattice, indices, Sponge::getLatticeSize(depth), arena, CancellationToken());
+        Measure weld = measure([&]() {
+            Sponge::weldVertices(lattice, indices, weldedVertices, weldedIndices, batches, arena, CancellationToken());
+        });
+        double before = Sponge::getAverageCacheMissRatio(weldedIndices, batches, 16);
+        double largeBefore = Sponge::getAverageCacheMissRatio(weldedIndices, batches, 32);
+        Measure reorder = measure([&]() {
+            for (const IndexBatch &batch : batches) {
+                Sponge::optimizeVertexCache(weldedVertices, weldedIndices, batch, arena, CancellationToken());
+            }
+        });
+        double after = Sponge::getAverageCacheMissRatio(weldedIndices, batches, 16);
+        double largeAfter = Sponge::getAverageCacheMissRatio(weldedIndices, batches, 32);
+
+        cout << setw(5) << (int) depth << setw(12) << weldedIndices.size() / 3 << fixed << setprecision(3)
+             << setw(17) << before << setw(8) << after << setw(17) << largeBefore << setw(8) << largeAfter
+             << setw(7) << (double) weldedVertices.size() / 4 / (weldedIndices.size() / 3) << setprecision(1)
+             << setw(12) << weld.milliseconds << setw(15) << reorder.milliseconds << endl;
+    }
+}
+
+/**
+ * Cull the meshlets of the depth 3 cell sponge in an opaque cube seen from 64 positions of the camera around it,
+ * the cell being rotated in the XW plane, and report what is culled and what culling costs. The close camera sees
+ * part of the cube only
+ */
+static void benchmarkMeshletCulling() {
+    const uint8_t depth = 3;
+    const float cameraOffset4D = 3.0f;
+    SpongeGenerator generator;
+    CellSponge cellSponge;
+    generator.generateCellSponge(depth, cellSponge, CancellationToken());
+    const glm::mat4 projection = glm::perspective(glm::pi<float>() / 4.0f, 1280.0f / 720.0f, 0.1f, 100.0f);
+    MeshletCuller culler;
+    vector<IndexBatch> ranges;
+
+    cout << endl << "culling " << cellSponge.meshlets.size() << " meshlets of " << Meshlet::MAX_TRIANGLES
+         << " triangles at most at depth " << (int) depth << endl
+         << "camera distance   looking away   out of view   triangles drawn   ranges   time (ms)" << endl;
+    for (float distance : {3.0f, 1.2f}) {
+        culler.resetStatistics();
+        uint64_t rangeCount = 0;
+        double milliseconds = 0.0;
+        for (uint8_t position = 0; position < 64; ++position) {
+            /* Same placement as Window::getCellToWorld, the model matrix being the identity when folded */
+            float angle = (float) position / 64.0f * 2.0f * glm::pi<float>();
+            glm::vec4 corners[8];
+            for (uint8_t corner = 0; corner < 8; ++corner) {
+                glm::vec4 point(cube[3 * corner], cube[3 * corner + 1], cube[3 * corner + 2],
+                                0.25f * cube[3 * corner] - 1.0f);
+                corners[corner] = glm::vec4(cos(angle) * point.x + sin(angle) * point.w, point.y, point.z,
+                                            -sin(angle) * point.x + cos(angle) * point.w);
+            }
+            glm::mat4 cellToWorld(corners[1] - corners[0], corners[2] - corners[0], corners[4] - corners[0],
+                                  corners[0]);
+            for (uint8_t column = 0; column < 4; ++column) {
+                cellToWorld[column].w = (column == 3 ? cameraOffset4D : 0.0f) - cellToWorld[column].w;
+            }
+            float vertical = 0.6f * sin(3.0f * angle);
+            glm::vec3 camera = distance * glm::vec3(sin(angle) * cos(vertical), sin(vertical),
+                                                    cos(angle) * cos(vertical));
+            glm::mat4 viewProjection = projection * glm::lookAt(camera, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            milliseconds += measure([&]() {
+                culler.cull(cellSponge, cellToWorld, viewProjection, camera, true, ranges);
+            }).milliseconds;
+            rangeCount += ranges.size();
+        }
+
+        const CullingStatistics &statistics = culler.getStatistics();
+        cout << fixed << setprecision(1) << setw(15) << distance << setw(14)
+             << 100.0 * statistics.backFacing / statistics.meshlets << "%" << setw(13)
+             << 100.0 * statistics.offScreen / statistics.meshlets << "%" << setw(17)
+             << 100.0 * statistics.drawnTriangles / statistics.triangles << "%" << setw(9) << rangeCount / 64
+             << setprecision(3) << setw(12) << milliseconds / 64 << endl;
+    }
+}
+
+/**
+ * Cancel the generation of the depth 4 cell sponge and of the depth 5 chunked sponge after various delays, reaching
+ * every step of the generation, and report how long the worker takes to stop once its token is raised
+ * @param threads is the number of threads working on the generation
+ */
+static void benchmarkCancellation(uint32_t threads) {
+    const uint32_t delays[] = {0, 10, 50, 200, 500, 1000, 1500, 2000};
+
+    cout << endl << "cancel after (ms)   cell sponge d4 stops in (ms)   chunks d5 stop in (ms)" << endl;
+    for (uint32_t delay : delays) {
+        double latencies[2];
+        for (uint8_t chunked = 0; chunked < 2; ++chunked) {
+            /* A new generator each time, so that the depth 4 leaves aren't kept from the previous run */
+            SpongeGenerator generator(threads);
+            CellSponge cellSponge;
+            ChunkStore store;
+            CancellationToken cancellation;
+            chrono::steady_clock::time_point end;
+            thread worker([&]() {
+                if (chunked) {
+                    generator.generateChunks(5, store, cancellation);
+                } else {
+                    generator.generateCellSponge(4, cellSponge, cancellation);
+                }
+                end = chrono::steady_clock::now();
+            });
+            this_thread::sleep_for(chrono::milliseconds(delay));
+            auto start = chrono::steady_clock::now();
+            cancellation.cancel();
+            worker.join();
+            /* A generation that ended before being cancelled didn't have to stop */
+            latencies[chunked] = end > start ? chrono::duration<double, milli>(end - start).count() : 0.0;
+        }
+        cout << setw(17) << delay << fixed << setprecision(2) << setw(31) << latencies[0] << setw(25)
+             << latencies[1] << endl;
+    }
+}
+
+/**
+ * Positions of a dragged gauge predicted by a DragPredictor, given in gauge steps
+ */
+struct PredictedPositions {
+    uint32_t positions[DragPredictor::PREDICTION_COUNT];
+    uint8_t count;
+    shared_ptr<CancellationToken> cancellation;
+};
+
+/**
+ * Place the corners of 8 cells leaning along W, then rotate them in the XW plane by a gauge value
+ * @param gauge is the value of the rotation gauge, from 0 to 1
+ * @param corners is an array where the 8 corners of each of the 8 cells will be written to
+ */
+static void rotateCells(float gauge, glm::vec4 *corners) {
+    float angle = gauge * 2.0f * glm::pi<float>();
+    for (uint8_t cell = 0; cell < 8; ++cell) {
+        for (uint8_t corner = 0; corner < 8; ++corner) {
+            glm::vec4 point(cube[3 * corner] + 3.0f * (float) cell, cube[3 * corner + 1], cube[3 * corner + 2],
+                            0.25f * cube[3 * corner] - 1.0f);
+            corners[8 * cell + corner] = glm::vec4(cos(angle) * point.x + sin(angle) * point.w, point.y, point.z,
+                                                   -sin(angle) * point.x + cos(angle) * point.w);
+        }
+    }
+}
+
+/**
+ * Drag a rotation gauge by a number of steps per 16 ms frame, projecting the shallow sponge at every position the
+ * way the depth scheduler does during a drag, then stop it. With speculation, a background thread projects the cell
+ * sponge at the positions a DragPredictor expects next, the way Window's speculation worker does
+ * @param generator is the generator to project with
+ * @param shallowSponge is the sponge displayed during the drag
+ * @param cellSponge is the full depth sponge
+ * @param speed is the number of gauge steps per frame
+ * @param speculation is true if the positions ahead of the drag are projected in the background
+ * @return the time between the last move and the full depth projection of the final position, in milliseconds
+ */
+static double dragAndStop(SpongeGenerator &generator, const CellSponge &shallowSponge, const CellSponge &cellSponge,
+                          uint32_t speed, bool speculation) {
+    const float cameraOffset4D = 3.0f;
+    const float gaugeStep = 1.0f / 1024.0f;
+    const uint32_t frames = 30;
+    PointArrays vertices[8], normals[8];
+    glm::vec4 corners[8 * 8];
+
+    /* Positions projected by the background thread */
+    mutex workerMutex;
+    condition_variable wakeUp;
+    set<uint32_t> projected;
+    bool stopping = false;
+    Mailbox<PredictedPositions> requests;
+    thread worker;
+    if (speculation) {
+        worker = thread([&]() {
+            PredictedPositions request{};
+            bool requestTaken = false;
+            PointArrays workerVertices[8], workerNormals[8];
+            glm::vec4 workerCorners[8 * 8];
+            while (true) {
+                if (!requestTaken) {
+                    unique_lock<mutex> lock(workerMutex);
+                    wakeUp.wait(lock, [&]() { return stopping || requests.take(request); });
+                    if (stopping) return;
+                }
+                requestTaken = false;
+                for (uint8_t position = 0; position < request.count && !requestTaken; ++position) {
+                    {
+                        lock_guard<mutex> lock(workerMutex);
+                        if (projected.count(request.positions[position])) continue;
+                    }
+                    rotateCells((float) request.positions[position] * gaugeStep, workerCorners);
+                    if (!generator.projectInBackground(cellSponge, workerCorners, 8, cameraOffset4D, workerVertices,
+                                                       workerNormals, *request.cancellation)) break;
+                    lock_guard<mutex> lock(workerMutex);
+                    projected.insert(request.positions[position]);
+                    requestTaken = requests.take(request);
+                }
+            }
+        });
+    }
+
+    DragPredictor predictor;
+    PredictedPositions predicted{};
+    uint32_t position = 100;
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        auto frameEnd = chrono::steady_clock::now() + chrono::milliseconds(16);
+        position += speed;
+        rotateCells((float) position * gaugeStep, corners);
+        generator.project(shallowSponge, corners, 8, cameraOffset4D, vertices, normals);
+        if (speculation) {
+            /* Same policy as Window::speculate: a drag that left the predicted positions cancels them */
+            if (find(predicted.positions, predicted.positions + predicted.count, position) ==
+                predicted.positions + predicted.count && predicted.cancellation) {
+                predicted.cancellation->cancel();
+            }
+            float rotations[6] = {0.0f, 0.0f, 0.0f, (float) position * gaugeStep, 0.0f, 0.0f};
+            predictor.record(rotations);
+            predicted.count = 0;
+            for (uint8_t step = 1; step <= DragPredictor::PREDICTION_COUNT; ++step) {
+                if (!predictor.predict(step, rotations)) break;
+                predicted.positions[predicted.count++] = (uint32_t) lround(rotations[3] / gaugeStep);
+            }
+            if (!predicted.cancellation || predicted.cancellation->isCancelled()) {
+                predicted.cancellation = make_shared<CancellationToken>();
+            }
+            requests.post(predicted);
+            {
+                lock_guard<mutex> lock(workerMutex);
+            }
+            wakeUp.notify_one();
+        }
+        this_thread::sleep_until(frameEnd);
+    }
+
+    /* The gauge stopped: the final position is displayed at once if it was projected ahead of the drag, otherwise
+     * the speculation is cancelled and it is projected now, the way the window refines a released gauge */
+    auto stop = chrono::steady_clock::now();
+    bool found;
+    {
+        lock_guard<mutex> lock(workerMutex);
+        found = projected.count(position) != 0;
+    }
+    if (!found) {
+        if (predicted.cancellation) predicted.cancellation->cancel();
+        rotateCells((float) position * gaugeStep, corners);
+        generator.project(cellSponge, corners, 8, cameraOffset4D, vertices, normals);
+    }
+    double latency = chrono::duration<double, milli>(chrono::steady_clock::now() - stop).count();
+
+    if (speculation) {
+        {
+            lock_guard<mutex> lock(workerMutex);
+            stopping = true;
+        }
+        if (predicted.cancellation) predicted.cancellation->cancel();
+        wakeUp.notify_one();
+        worker.join();
+    }
+    return latency;
+}
+
+/**
+ * Report how long the full depth projection of a dragged gauge's final position takes to be available once it stops,
+ * with and without the positions ahead of the drag being projected speculatively
+ * @param threads is the number of threads to use
+ */
+static void benchmarkSpeculation(uint32_t threads) {
+    cout << endl << "drag for 30 frames then stop, full depth available after (ms) on " << threads << " threads"
+         << endl << "depth   steps per frame   without speculation   with speculation" << endl;
+    for (uint8_t depth = 2; depth <= 3; ++depth) {
+        SpongeGenerator generator(threads);
+        CellSponge shallowSponge, cellSponge;
+        generator.generateCellSponge(depth - 1, shallowSponge, CancellationToken());
+        generator.generateCellSponge(depth, cellSponge, CancellationToken());
+        for (uint32_t speed : {1u, 4u}) {
+            double latencies[2];
+            for (uint8_t speculation = 0; speculation < 2; ++speculation) {
+                latencies[speculation] = dragAndStop(generator, shallowSponge, cellSponge, speed, speculation != 0);
+            }
+            cout << setw(5) << (int) depth << setw(18) << speed << fixed << setprecision(2) << setw(22)
+                 << latencies[0] << setw(19) << latencies[1] << endl;
+        }
+    }
+}
+
+/**
+ * Benchmark entry point
+ * @param argc
+ * @param argv may hold the largest number of threads to try, every hardware thread is used by default
+ * @return
+ */
+int main(int argc, char **argv) {
+    uint32_t maxThreads = argc > 1 ? (uint32_t) atoi(argv[1]) : thread::hardware_concurrency();
+
+    benchmarkSubdivision();
+    benchmarkLatticeKernel();
+    benchmarkThreadScaling(max(1u, maxThreads));
+    benchmarkReprojection(max(1u, maxThreads));
+    benchmarkMeshStages();
+    benchmarkCoincidentFaces();
+    benchmarkFaceMerging();
+    benchmarkIndexBatches();
+    benchmarkVertexCache();
+    benchmarkMeshletCulling();
+    benchmarkCancellation(max(1u, maxThreads));
+    benchmarkSpeculation(max(1u, maxThreads));
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef FRACTALS_PLATONIC4D_ARENA_H
+#define FRACTALS_PLATONIC4D_ARENA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Bump allocator owned by a single sponge worker.
+ * Memory is handed out linearly from large blocks and given back either all at once (reset) or down to a
+ * previously taken mark (release), so the blocks are reused from one computation to the next and the hot paths
+ * never reach the heap once the arena has grown to its working size.
+ */
+class Arena {
+public:
+    /**
+     * Position inside the arena, used to give back everything allocated after it
+     */
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+
+private:
+    struct Block {
+        unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    vector<Block> blocks;
+    size_t currentBlock = 0;
+    size_t offset = 0;
+    uint64_t blockAllocations = 0;
+
+public:
+    /**
+     * @param blockSize is the minimal size in bytes of each block requested from the heap
+     */
+    explicit Arena(size_t blockSize = 1u << 20u);
+
+    /**
+     * Allocate an uninitialized array from the arena
+     * @param count is the number of elements of the array
+     * @return a pointer valid until the arena is reset or released to a prior mark
+     */
+    template<typename T>
+    T *allocate(size_t count) {
+        return static_cast<T *>(allocateBytes(count * sizeof(T), alignof(T)));
+    }
+
+    /**
+     * @return the current position of the arena
+     */
+    Mark mark() const;
+
+    /**
+     * Give back every allocation made after the given mark
+     * @param mark is a position previously returned by mark()
+     */
+    void release(const Mark &mark);
+
+    /**
+     * Give back every allocation, keeping the blocks for future use
+     */
+    void reset();
+
+    /**
+     * Give the blocks that hold no allocation back to the heap: the ones past the current block, and the current
+     * block itself when nothing was allocated from it. A computation that needed far more memory than usual doesn't
+     * keep it for the next ones
+     */
+    void trim();
+
+    /**
+     * @return the number of blocks that were requested from the heap since the arena creation
+     */
+    uint64_t getBlockAllocations() const;
+
+private:
+    /**
+     * Allocate raw memory from the arena, moving to the next block (or creating one) if the current is exhausted
+     * @param size in bytes
+     * @param alignment in bytes, must be a power of two
+     * @return
+     */
+    void *allocateBytes(size_t size, size_t alignment);
+};
+
+#endif //FRACTALS_PLATONIC4D_ARENA_H
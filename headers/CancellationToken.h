@@ -0,0 +1,44 @@
+#ifndef FRACTALS_PLATONIC4D_CANCELLATIONTOKEN_H
+#define FRACTALS_PLATONIC4D_CANCELLATIONTOKEN_H
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Flag raised by the thread that started a job when its result isn't needed anymore.
+ * The job reads it between bounded amounts of work and returns as soon as it is raised, leaving its output
+ * incomplete, so that the thread waiting for it is never held up for long and no exception crosses the workers.
+ */
+class CancellationToken {
+private:
+    atomic<bool> cancelled;
+
+public:
+    /* Number of quads or leaves a loop handles between two reads of the token, well under a millisecond of work */
+    static const uint32_t CHECK_INTERVAL = 4096;
+
+    CancellationToken();
+
+    CancellationToken(const CancellationToken &) = delete;
+
+    CancellationToken &operator=(const CancellationToken &) = delete;
+
+    /**
+     * Ask the job to stop, may be called from any thread
+     */
+    void cancel();
+
+    /**
+     * Lower the flag before the token is given to a new job, no job may be using it
+     */
+    void reset();
+
+    /**
+     * @return true if the job was asked to stop
+     */
+    bool isCancelled() const;
+};
+
+#endif //FRACTALS_PLATONIC4D_CANCELLATIONTOKEN_H
@@ -0,0 +1,134 @@
+#ifndef FRACTALS_PLATONIC4D_CHUNKSTORE_H
+#define FRACTALS_PLATONIC4D_CHUNKSTORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Sponge.h"
+
+using namespace std;
+
+/**
+ * Part of a sponge kept in a ChunkStore: the mesh of one lattice cube, merged and welded on its own
+ */
+struct SpongeChunk {
+    LatticeCube cube;
+    /* Position of the chunk in the file, its vertices (4 unsigned shorts each, see CellSponge) being followed by its
+     * 16 bit indices, then by its batches (see IndexBatch), which start at 0 for the chunk's first vertex */
+    uint64_t offset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t batchCount;
+};
+
+/**
+ * Sponge too large for the memory, written in chunks to a memory-mapped file.
+ * The file is sized once for the largest chunks possible and left sparse, so only the chunks written use disk space,
+ * and the system pages them in and out of memory as they are read. It is removed as soon as it is created, so that
+ * it never outlives the program.
+ * Chunks are written by the generator workers in any order, each one may be read as soon as it is ready.
+ */
+class ChunkStore {
+private:
+    int file = -1;
+    uint8_t *data = nullptr;
+    uint64_t capacity = 0;
+    atomic<uint64_t> usedBytes;
+    vector<SpongeChunk> chunks;
+    unique_ptr<atomic<bool>[]> ready;
+    uint8_t depth = 0;
+    uint16_t latticeSize = 1;
+
+public:
+    /* Depth of the subtree held by each chunk of a deeper sponge, so that a worker only keeps one such subtree in
+     * memory at a time */
+    static const uint8_t CHUNK_DEPTH = 3;
+
+    ChunkStore();
+
+    ~ChunkStore();
+
+    ChunkStore(const ChunkStore &) = delete;
+
+    ChunkStore &operator=(const ChunkStore &) = delete;
+
+    /**
+     * Create the file of a sponge, closing the previous one. No chunk may be written or read meanwhile
+     * @param depth is the depth of the sponge
+     * @param cubes are the lattice cubes of the chunks (see Sponge::splitLattice)
+     * @param capacity is the size in bytes of the file, large enough for every chunk
+     * @throw runtime_error if the file can't be created or mapped
+     */
+    void open(uint8_t depth, const vector<LatticeCube> &cubes, uint64_t capacity);
+
+    /**
+     * Unmap and remove the file of the sponge
+     */
+    void close();
+
+    /**
+     * Copy a chunk to the file and mark it as ready, may be called by several workers at once
+     * @param chunk is the position of the chunk's cube in the cubes given to open
+     * @param vertices is a vector containing the welded vertices of the chunk (see CellSponge)
+     * @param indices is a vector containing the indices of the chunk, relative to their batch
+     * @param batches is a vector containing the batches of the chunk
+     * @throw length_error if the file is full
+     */
+    void write(uint32_t chunk, const vector<uint16_t> &vertices, const vector<uint16_t> &indices,
+               const vector<IndexBatch> &batches);
+
+    /**
+     * @param chunk is the position of the chunk
+     * @return true if the chunk was written and may be read
+     */
+    bool isReady(uint32_t chunk) const;
+
+    /**
+     * @param chunk is the position of a ready chunk
+     * @return the description of the chunk
+     */
+    const SpongeChunk &getChunk(uint32_t chunk) const;
+
+    /**
+     * @param chunk is a ready chunk
+     * @return its vertices, mapped from the file
+     */
+    const uint16_t *getVertices(const SpongeChunk &chunk) const;
+
+    /**
+     * @param chunk is a ready chunk
+     * @return its indices, mapped from the file
+     */
+    const uint16_t *getIndices(const SpongeChunk &chunk) const;
+
+    /**
+     * @param chunk is a ready chunk
+     * @return its batches, mapped from the file
+     */
+    const IndexBatch *getBatches(const SpongeChunk &chunk) const;
+
+    /**
+     * @return the number of chunks of the sponge, ready or not
+     */
+    uint32_t getChunkCount() const;
+
+    /**
+     * @return the depth of the sponge, 0 if no file is open
+     */
+    uint8_t getDepth() const;
+
+    /**
+     * @return the number of lattice steps along an edge of the cell (see Sponge::getLatticeSize)
+     */
+    uint16_t getLatticeSize() const;
+
+    /**
+     * @return the number of bytes written to the file
+     */
+    uint64_t getUsedBytes() const;
+};
+
+#endif //FRACTALS_PLATONIC4D_CHUNKSTORE_H
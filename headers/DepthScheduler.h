@@ -0,0 +1,112 @@
+#ifndef FRACTALS_PLATONIC4D_DEPTHSCHEDULER_H
+#define FRACTALS_PLATONIC4D_DEPTHSCHEDULER_H
+
+#include <cstdint>
+
+#include "Sponge.h"
+
+using namespace std;
+
+/**
+ * Picks the depth of the sponge displayed by the CPU projection from the time each depth takes on this machine.
+ * While the user drags a gauge, every change waits for a projection and an upload, so the deepest sponge whose
+ * projection and upload fit in the latency budget is displayed. Once the input is idle, the full depth is.
+ * Timings are running averages, depths that were never measured are estimated from a shallower one.
+ */
+class DepthScheduler {
+private:
+    /**
+     * Running averages of the timings of a depth in milliseconds, negative until a first measure
+     */
+    struct DepthTimings {
+        double generation = -1.0;
+        double projection = -1.0;
+        double upload = -1.0;
+    };
+
+    DepthTimings timings[Sponge::MAX_DEPTH + 1];
+    double budget;
+    uint8_t chosenDepth = 0;
+
+public:
+    /* Weight of a new measure in the running averages, the projection time of a depth varies with the rotation */
+    static constexpr double SMOOTHING = 0.25;
+
+    /**
+     * @param budget is the latency allowed between a change of the rotations and its display, in milliseconds
+     */
+    explicit DepthScheduler(double budget = 50.0);
+
+    /**
+     * @param depth is the depth of a sponge that was generated
+     * @param milliseconds is the time it took
+     */
+    void recordGeneration(uint8_t depth, double milliseconds);
+
+    /**
+     * @param depth is the depth of a sponge that was projected in every cube
+     * @param milliseconds is the time it took
+     */
+    void recordProjection(uint8_t depth, double milliseconds);
+
+    /**
+     * @param depth is the depth of a projected sponge that was uploaded to the GPU
+     * @param milliseconds is the time it took
+     */
+    void recordUpload(uint8_t depth, double milliseconds);
+
+    /**
+     * Give the time between a change of the rotations and its display at a depth. A depth that was never measured
+     * costs 20 times the depth above it (a level has 20 times more cubes), 0 if no shallower depth was measured either
+     * @param depth is the depth of the sponge
+     * @return the time of a projection and an upload in milliseconds
+     */
+    double estimateLatency(uint8_t depth) const;
+
+    /**
+     * Choose the depth to display among the sponges available
+     * @param interacting is true while the user changes the rotations
+     * @param shallowest is the shallowest depth available
+     * @param deepest is the deepest depth available
+     * @return deepest if the input is idle, the deepest depth within the budget otherwise (shallowest if none is)
+     */
+    uint8_t chooseDepth(bool interacting, uint8_t shallowest, uint8_t deepest);
+
+    /**
+     * @return the latency budget in milliseconds
+     */
+    double getBudget() const;
+
+    /**
+     * @return the depth returned by the last call to chooseDepth
+     */
+    uint8_t getChosenDepth() const;
+
+    /**
+     * @param depth
+     * @return the average generation time of the depth in milliseconds, negative if it wasn't measured
+     */
+    double getGenerationMilliseconds(uint8_t depth) const;
+
+    /**
+     * @param depth
+     * @return the average projection time of the depth in milliseconds, negative if it wasn't measured
+     */
+    double getProjectionMilliseconds(uint8_t depth) const;
+
+    /**
+     * @param depth
+     * @return the average upload time of the depth in milliseconds, negative if it wasn't measured
+     */
+    double getUploadMilliseconds(uint8_t depth) const;
+
+private:
+    /**
+     * Add a measure to a running average
+     * @param average is the running average, negative if there wasn't any measure yet
+     * @param milliseconds is the new measure
+     */
+    static void addMeasure(double &average, double milliseconds);
+};
+
+#endif //FRACTALS_PLATONIC4D_DEPTHSCHEDULER_H
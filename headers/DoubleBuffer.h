@@ -0,0 +1,73 @@
+#ifndef FRACTALS_PLATONIC4D_DOUBLEBUFFER_H
+#define FRACTALS_PLATONIC4D_DOUBLEBUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Two copies of a value shared by one thread producing it and one thread consuming it. The producer writes the back
+ * copy while the consumer reads the front one, then publishes it by swapping them with a single atomic store.
+ * The consumer never waits and never sees a copy being written. The producer waits for the consumer to take the
+ * published copy before writing the other one, which is the copy the consumer was reading until then.
+ */
+template<typename T>
+class DoubleBuffer {
+private:
+    /* Bit set on the front index when the front copy was published and not taken yet */
+    static const uint8_t FRESH = 2;
+
+    T buffers[2];
+    atomic<uint8_t> front;
+
+public:
+    DoubleBuffer() : front(0) {}
+
+    DoubleBuffer(const DoubleBuffer &) = delete;
+
+    DoubleBuffer &operator=(const DoubleBuffer &) = delete;
+
+    /**
+     * @return true if the consumer took the last published copy, so that the producer may write the back copy
+     */
+    bool isWritable() const {
+        return !(front.load(memory_order_acquire) & FRESH);
+    }
+
+    /**
+     * @return the back copy, only written by the producer while isWritable
+     */
+    T &getBack() {
+        return buffers[1 - (front.load(memory_order_relaxed) & 1)];
+    }
+
+    /**
+     * Swap the copies, the back copy the producer wrote becoming the front one
+     */
+    void publish() {
+        uint8_t back = 1 - (front.load(memory_order_relaxed) & 1);
+        front.store(back | FRESH, memory_order_release);
+    }
+
+    /**
+     * Take the front copy if it was published since the last call, only called by the consumer
+     * @return true if the front copy is new
+     */
+    bool take() {
+        uint8_t current = front.load(memory_order_acquire);
+        if (!(current & FRESH)) return false;
+        /* The producer only publishes once the copy was taken, so the flag can be lowered without an exchange */
+        front.store(current & 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @return the front copy, read by the consumer until it takes the next one
+     */
+    const T &getFront() const {
+        return buffers[front.load(memory_order_acquire) & 1];
+    }
+};
+
+#endif //FRACTALS_PLATONIC4D_DOUBLEBUFFER_H
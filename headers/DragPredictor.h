@@ -0,0 +1,42 @@
+#ifndef FRACTALS_PLATONIC4D_DRAGPREDICTOR_H
+#define FRACTALS_PLATONIC4D_DRAGPREDICTOR_H
+
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Predicts the next positions of the rotation gauges while one of them is dragged. A drag moves a gauge by about the
+ * same amount from one change to the next, so the next positions continue the last move.
+ */
+class DragPredictor {
+private:
+    float rotations[6]{};
+    float velocity[6]{};
+    bool dragging = false;
+
+public:
+    /* Number of positions predicted ahead of the last one */
+    static const uint8_t PREDICTION_COUNT = 3;
+
+    /**
+     * Record the position of the gauges after a change
+     * @param newRotations is an array of the 6 rotation gauge values
+     */
+    void record(const float *newRotations);
+
+    /**
+     * Forget the drag, the next position recorded starts a new one
+     */
+    void reset();
+
+    /**
+     * Give a predicted position of the gauges
+     * @param step is the number of changes ahead of the last position recorded, from 1 to PREDICTION_COUNT
+     * @param predictedRotations is an array where the 6 predicted gauge values will be written to
+     * @return false if there is no prediction: the drag hasn't moved yet, or the gauge would leave its range
+     */
+    bool predict(uint8_t step, float *predictedRotations) const;
+};
+
+#endif //FRACTALS_PLATONIC4D_DRAGPREDICTOR_H
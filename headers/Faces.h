@@ -1,6 +1,8 @@
 #ifndef FRACTALS_PLATONIC4D_FACES_H
 #define FRACTALS_PLATONIC4D_FACES_H
 
+#include <cstdint>
+
 enum Faces {
     Back = 0,
     Bottom = 1,
@@ -10,4 +12,19 @@ enum Faces {
     Front = 5,
 };
 
+/**
+ * Set of faces, the bit N is set when the face N belongs to the set
+ */
+typedef uint8_t FacesMask;
+
+static const FacesMask ALL_FACES = 0x3F;
+
+/**
+ * @param face
+ * @return the mask containing only the given face
+ */
+constexpr FacesMask faceBit(Faces face) {
+    return (FacesMask) (1u << face);
+}
+
 #endif //FRACTALS_PLATONIC4D_FACES_H
@@ -22,12 +22,15 @@ protected:
             glm::vec4(-1.0f, 1.0f, 1.0f, 1.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f),
     };
     vector<glm::vec4> hypercubePoints = baseHypercubePoints;
+    /* Composition of the rotations applied since the last reset */
+    glm::mat4 hypercubeRotation = glm::mat4(1.0f);
 
     /**
      * Resets the hypercube point buffer
      */
     void init4DRotations() {
         hypercubePoints = baseHypercubePoints;
+        hypercubeRotation = glm::mat4(1.0f);
     }
 
     /**
@@ -44,6 +47,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 
     /**
@@ -60,6 +64,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 
     /**
@@ -76,6 +81,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 
     /**
@@ -92,6 +98,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 
     /**
@@ -108,6 +115,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 
     /**
@@ -124,6 +132,7 @@ protected:
         for (glm::vec4 &p: hypercubePoints) {
             p = rot * p;
         }
+        hypercubeRotation = rot * hypercubeRotation;
     }
 };
 
@@ -0,0 +1,80 @@
+#ifndef FRACTALS_PLATONIC4D_LATTICEKERNEL_H
+#define FRACTALS_PLATONIC4D_LATTICEKERNEL_H
+
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Evaluates the 64 points of the lattice splitting a hexahedron into 27, in one pass from its 8 corners: the trilinear
+ * weights of the points factor into one weight per axis, so the lattice is interpolated one axis at a time from
+ * constant weights, without going through the edges and faces of the hexahedron. Each coordinate is interpolated on
+ * its own and written to its own array, the layout of PointArrays.
+ * The instruction set is chosen at run time among the ones the CPU supports, with a scalar fallback everywhere else.
+ * The paths round differently (the AVX2 one fuses its multiplications and additions), the points they give agree to
+ * a few units in the last place.
+ */
+class LatticeKernel {
+public:
+    /**
+     * Instruction set used to evaluate the points
+     */
+    enum Path {
+        SCALAR = 0,
+        SSE = 1,
+        AVX2 = 2,
+        PATH_COUNT = 3,
+    };
+
+    /**
+     * Evaluate the lattice of a hexahedron
+     * @param corners is an array of the 8 corners of the hexahedron, in the order given to
+     *        Sponge::subdivideParallelepiped
+     * @param x is an array of 64 floats where the abscissas of the lattice points will be written to: point
+     *        i + 4j + 16k is i thirds of the way along the first edge, j along the second and k along the third
+     * @param y is an array of 64 floats where their ordinates will be written to
+     * @param z is an array of 64 floats where their heights will be written to
+     */
+    static void evaluate(const float *corners, float *x, float *y, float *z);
+
+    /**
+     * @param path is an instruction set
+     * @return true if this CPU and this build can use it
+     */
+    static bool isSupported(Path path);
+
+    /**
+     * Choose the instruction set, the fastest supported one is chosen at start up. Not thread safe, only meant for
+     * comparing the paths before any generation starts
+     * @param path is a supported instruction set
+     */
+    static void setPath(Path path);
+
+    /**
+     * @return the instruction set in use
+     */
+    static Path getPath();
+
+    /**
+     * @param path is an instruction set
+     * @return its name
+     */
+    static const char *getPathName(Path path);
+
+private:
+    static Path path;
+    static void (*kernel)(const float *corners, float *x, float *y, float *z);
+
+    /**
+     * @return the fastest instruction set the CPU supports
+     */
+    static Path detectPath();
+
+    static void evaluateScalar(const float *corners, float *x, float *y, float *z);
+
+    static void evaluateSse(const float *corners, float *x, float *y, float *z);
+
+    static void evaluateAvx2(const float *corners, float *x, float *y, float *z);
+};
+
+#endif //FRACTALS_PLATONIC4D_LATTICEKERNEL_H
@@ -0,0 +1,142 @@
+#ifndef FRACTALS_PLATONIC4D_LRUCACHE_H
+#define FRACTALS_PLATONIC4D_LRUCACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * Cache of values that are expensive to compute, holding as many as fit in a memory budget: inserting a value evicts
+ * the least recently used ones until it fits. Values are shared and immutable, an evicted value stays alive as long as
+ * someone uses it.
+ * Every method takes an internal lock, so values may be inserted by one thread and looked up by another.
+ */
+template<typename Key, typename Value, typename Hash>
+class LruCache {
+private:
+    struct Entry {
+        Key key;
+        shared_ptr<const Value> value;
+        uint64_t bytes;
+    };
+
+    /* Entries from the most recently used to the least, and where each key is in the list */
+    list<Entry> entries;
+    unordered_map<Key, typename list<Entry>::iterator, Hash> positions;
+    uint64_t budget;
+    uint64_t usedBytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    mutable mutex entriesMutex;
+
+public:
+    /**
+     * @param budget is the memory the values may use, in bytes
+     */
+    explicit LruCache(uint64_t budget) : budget(budget) {}
+
+    LruCache(const LruCache &) = delete;
+
+    LruCache &operator=(const LruCache &) = delete;
+
+    /**
+     * Give the value of a key, which becomes the most recently used one
+     * @param key is the key of the value
+     * @return the value, empty if the key isn't in the cache
+     */
+    shared_ptr<const Value> find(const Key &key) {
+        lock_guard<mutex> lock(entriesMutex);
+        auto position = positions.find(key);
+        if (position == positions.end()) {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        entries.splice(entries.begin(), entries, position->second);
+        return position->second->value;
+    }
+
+    /**
+     * Tell if a key is in the cache, without counting as a lookup or making it more recently used
+     * @param key is the key of the value
+     * @return true if the key is in the cache
+     */
+    bool contains(const Key &key) const {
+        lock_guard<mutex> lock(entriesMutex);
+        return positions.count(key) != 0;
+    }
+
+    /**
+     * Insert the value of a key, replacing the previous one, then evict the least recently used values until the
+     * cache fits in its budget. A value larger than the whole budget isn't inserted
+     * @param key is the key of the value
+     * @param value is the value
+     * @param bytes is the memory used by the value
+     */
+    void insert(const Key &key, shared_ptr<const Value> value, uint64_t bytes) {
+        lock_guard<mutex> lock(entriesMutex);
+        auto position = positions.find(key);
+        if (position != positions.end()) {
+            usedBytes -= position->second->bytes;
+            entries.erase(position->second);
+            positions.erase(position);
+        }
+        if (bytes > budget) return;
+        while (usedBytes + bytes > budget) {
+            usedBytes -= entries.back().bytes;
+            positions.erase(entries.back().key);
+            entries.pop_back();
+        }
+        entries.push_front({key, move(value), bytes});
+        positions[key] = entries.begin();
+        usedBytes += bytes;
+    }
+
+    /**
+     * Remove every value
+     */
+    void clear() {
+        lock_guard<mutex> lock(entriesMutex);
+        entries.clear();
+        positions.clear();
+        usedBytes = 0;
+    }
+
+    /**
+     * @return the number of values in the cache
+     */
+    uint64_t getEntryCount() const {
+        lock_guard<mutex> lock(entriesMutex);
+        return entries.size();
+    }
+
+    /**
+     * @return the memory used by the values in the cache, in bytes
+     */
+    uint64_t getUsedBytes() const {
+        lock_guard<mutex> lock(entriesMutex);
+        return usedBytes;
+    }
+
+    /**
+     * @return the number of lookups that found their key
+     */
+    uint64_t getHits() const {
+        lock_guard<mutex> lock(entriesMutex);
+        return hits;
+    }
+
+    /**
+     * @return the number of lookups that didn't find their key
+     */
+    uint64_t getMisses() const {
+        lock_guard<mutex> lock(entriesMutex);
+        return misses;
+    }
+};
+
+#endif //FRACTALS_PLATONIC4D_LRUCACHE_H
@@ -0,0 +1,56 @@
+#ifndef FRACTALS_PLATONIC4D_MAILBOX_H
+#define FRACTALS_PLATONIC4D_MAILBOX_H
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Lock-free mailbox between one thread posting messages and one thread taking them, where only the latest message
+ * counts: a message posted before the previous one was taken replaces it.
+ * It holds 3 slots, one written by the poster, one read by the taker, and the latest message in between. Posting and
+ * taking exchange their slot with the one in between, so neither ever waits for the other.
+ */
+template<typename T>
+class Mailbox {
+private:
+    /* Bit set on the slot in between when it holds a message that wasn't taken yet */
+    static const uint8_t FRESH = 4;
+
+    T slots[3];
+    uint8_t postSlot = 0;
+    atomic<uint8_t> latestSlot;
+    uint8_t takeSlot = 2;
+
+public:
+    Mailbox() : latestSlot(1) {}
+
+    Mailbox(const Mailbox &) = delete;
+
+    Mailbox &operator=(const Mailbox &) = delete;
+
+    /**
+     * Post a message, replacing the one waiting if it wasn't taken. Only called by the posting thread
+     * @param message is the message to post
+     */
+    void post(const T &message) {
+        slots[postSlot] = message;
+        /* The release publishes the message with its slot, the previous message comes back to be overwritten */
+        postSlot = latestSlot.exchange(postSlot | FRESH, memory_order_acq_rel) & ~FRESH;
+    }
+
+    /**
+     * Take the latest message, only called by the taking thread
+     * @param message is where the message is written to
+     * @return false if no message was posted since the last one taken, message then being left as it is
+     */
+    bool take(T &message) {
+        if (!(latestSlot.load(memory_order_acquire) & FRESH)) return false;
+        takeSlot = latestSlot.exchange(takeSlot, memory_order_acq_rel) & ~FRESH;
+        message = slots[takeSlot];
+        return true;
+    }
+};
+
+#endif //FRACTALS_PLATONIC4D_MAILBOX_H
@@ -0,0 +1,62 @@
+#ifndef FRACTALS_PLATONIC4D_MESHLETCULLER_H
+#define FRACTALS_PLATONIC4D_MESHLETCULLER_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SpongeGenerator.h"
+
+using namespace std;
+
+/**
+ * Meshlets counted while culling them, summed over the cubes drawn since the counts were reset
+ */
+struct CullingStatistics {
+    uint64_t meshlets = 0;
+    uint64_t backFacing = 0;
+    uint64_t offScreen = 0;
+    uint64_t triangles = 0;
+    uint64_t drawnTriangles = 0;
+};
+
+/**
+ * Skips the meshlets of a cell sponge that can't be seen in a cube before it is drawn: the ones whose faces all look
+ * away from the camera, and the ones out of view.
+ * A cube is placed by a projective map from cell space (an affine map to the 4D cell, then the projection from the
+ * camera on the W axis), which keeps planes and the side of a plane a point lies on. So the faces of a meshlet look
+ * away from the camera when the camera, brought back to cell space, is behind every plane they lie on.
+ */
+class MeshletCuller {
+private:
+    CullingStatistics statistics;
+
+public:
+    /**
+     * Find the meshlets of a cell sponge that may be seen in a cube and give the ranges of indices to draw
+     * @param cellSponge is the sponge drawn in the cube, with its meshlets
+     * @param cellToWorld maps the unit cube of cell space to world space in homogeneous coordinates, every point of
+     *        the cell having a positive W
+     * @param viewProjection maps world space to clip space
+     * @param cameraPosition is the position of the camera in world space
+     * @param cullBackFaces is false when the cube is translucent, its faces looking away from the camera then being
+     *        seen through the others
+     * @param ranges is a vector where the ranges to draw will be written to, as batches (see IndexBatch), consecutive
+     *        meshlets of a batch being merged
+     */
+    void cull(const CellSponge &cellSponge, const glm::mat4 &cellToWorld, const glm::mat4 &viewProjection,
+              const glm::vec3 &cameraPosition, bool cullBackFaces, vector<IndexBatch> &ranges);
+
+    /**
+     * @return the meshlets counted since the last reset
+     */
+    const CullingStatistics &getStatistics() const;
+
+    /**
+     * Start counting from 0 again
+     */
+    void resetStatistics();
+};
+
+#endif //FRACTALS_PLATONIC4D_MESHLETCULLER_H
@@ -0,0 +1,127 @@
+#ifndef FRACTALS_PLATONIC4D_POINTARRAYS_H
+#define FRACTALS_PLATONIC4D_POINTARRAYS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+using namespace std;
+
+/**
+ * Allocator giving memory aligned for the widest vector instructions, so that loops over a coordinate array may load
+ * and store whole registers from its first element
+ */
+template<typename T>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    static const size_t ALIGNMENT = 32;
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t count) {
+        /* The block is over allocated to be aligned by hand, the pointer to free is kept right before the array */
+        uint8_t *block = static_cast<uint8_t *>(::operator new(count * sizeof(T) + ALIGNMENT + sizeof(void *)));
+        uintptr_t start = ((uintptr_t) (block + sizeof(void *)) + ALIGNMENT - 1) & ~(uintptr_t) (ALIGNMENT - 1);
+        reinterpret_cast<void **>(start)[-1] = block;
+        return reinterpret_cast<T *>(start);
+    }
+
+    void deallocate(T *pointer, size_t) noexcept {
+        ::operator delete(reinterpret_cast<void **>(pointer)[-1]);
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U> &) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U> &) const {
+        return false;
+    }
+};
+
+/**
+ * Points of a mesh stored as a structure of arrays: one aligned array per axis instead of interleaved x, y, z
+ * triplets. A loop over the points then reads and writes each coordinate contiguously, which lets the compiler
+ * process several points at once. The GPU takes interleaved triplets, the arrays are only interleaved when uploaded.
+ */
+class PointArrays {
+private:
+    vector<float, AlignedAllocator<float>> coordinates[3];
+
+public:
+    /**
+     * @return the number of points
+     */
+    uint64_t size() const;
+
+    /**
+     * @return true if there are no points
+     */
+    bool empty() const;
+
+    /**
+     * Change the number of points, the new ones being at the origin
+     * @param count is the number of points
+     */
+    void resize(uint64_t count);
+
+    /**
+     * Keep room for a number of points, so that they are added without growing the arrays again
+     * @param count is the number of points
+     */
+    void reserve(uint64_t count);
+
+    /**
+     * Remove every point, keeping the memory of the arrays
+     */
+    void clear();
+
+    /**
+     * Add a point after the last one
+     * @param point is the point to add
+     */
+    void add(const glm::vec3 &point);
+
+    /**
+     * @param point is the position of a point
+     * @return its coordinates
+     */
+    glm::vec3 get(uint64_t point) const;
+
+    /**
+     * @param point is the position of a point
+     * @param value is its new coordinates
+     */
+    void set(uint64_t point, const glm::vec3 &value);
+
+    /**
+     * @param axis is 0 for the abscissas, 1 for the ordinates and 2 for the heights
+     * @return the array of the coordinates of every point along the axis
+     */
+    float *getCoordinates(uint8_t axis);
+
+    const float *getCoordinates(uint8_t axis) const;
+
+    /**
+     * Write the points as x, y, z triplets, the layout of the GPU vertex buffers
+     * @param target is an array of 3 * size() floats
+     */
+    void interleave(float *target) const;
+
+    /**
+     * @return the memory used by the points, in bytes
+     */
+    uint64_t getBytes() const;
+};
+
+#endif //FRACTALS_PLATONIC4D_POINTARRAYS_H
@@ -9,23 +9,88 @@
 #include <map>
 #include <algorithm>
 #include <future>
+#include <stdexcept>
+#include <string>
 
-#include "vectorTools.h"
+#include "Faces.h"
+#include "Arena.h"
+#include "CancellationToken.h"
+#include "LatticeKernel.h"
+#include "PointArrays.h"
 
 using namespace std;
 
 /**
- * Exception used to interrupt the computation of vertices if the result isn't needed anymore
+ * Description of one of the 20 children kept when a parallelepiped is subdivided
  */
-struct WorkerKilled : public exception {
-    const char * what () const throw () {
-        return "SpongeWorker was purposely killed";
-    }
+struct ChildDescription {
+    /* Indices of the 8 corners of the child inside the 64 vertices of the parent subdivision */
+    uint8_t corners[8];
+    /* Faces that are visible if the parent face they belong to is */
+    FacesMask possiblyApparentFaces;
+    /* Faces that are always visible, through the holes of the parent */
+    FacesMask mandatoryFaces;
+};
+
+/**
+ * Consecutive triangles of a mesh whose vertices fit 16 bit indices: its vertices are consecutive, and its indices are
+ * given from its first vertex, which is the base vertex of its draw
+ */
+struct IndexBatch {
+    /* Most vertices of a batch, the largest 16 bit index being left out for primitive restart */
+    static const uint32_t MAX_VERTICES = 65535;
+
+    uint32_t firstVertex;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+/**
+ * Consecutive quads of a batch that face the same way in cell space, culled as a whole when it faces away from the
+ * camera or is out of view. Its normal cone is a single direction in cell space, the cell's axis its quads face, so
+ * it is kept as the orientation of its quads and their lattice box, which spans the planes they lie on
+ */
+struct Meshlet {
+    /* Most triangles of a meshlet */
+    static const uint32_t MAX_TRIANGLES = 128;
+
+    /* Lattice box of the quads */
+    uint16_t lowest[3];
+    uint16_t highest[3];
+    /* Orientation of the quads (see Sponge::weldVertices) */
+    uint16_t orientation;
+    uint32_t batch;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+/**
+ * Number of elements of a sponge mesh
+ */
+struct MeshSize {
+    /* Vertices written by the subdivision */
+    uint64_t vertices;
+    /* Indices written by the subdivision */
+    uint64_t indices;
+    /* Vertices that duplicateVertices will append */
+    uint64_t duplicates;
+};
+
+/**
+ * Cube of the integer lattice, kept by the subdivision of the unit cube, that still has to be subdivided
+ */
+struct LatticeCube {
+    /* Lattice point of the cube's first corner */
+    uint16_t origin[3];
+    /* Number of lattice steps along the cube's edges */
+    uint16_t size;
+    /* Depth when to stop the subdivision of the cube */
+    uint8_t depth;
+    /* Faces of the cube that are visible */
+    FacesMask apparentFaces;
 };
 
 class Sponge {
-public:
-    static bool killComputation;
 private:
     std::vector<uint8_t> frontFaceIndices;
     std::vector<uint8_t> topFaceIndices;
@@ -35,8 +100,20 @@ private:
     std::vector<uint8_t> backFaceIndices;
     std::vector<std::vector<uint8_t> *> faceIndicesList;
     std::vector<uint8_t> innerParts;
+public:
+    /* Number of parallelepipeds kept each time one is subdivided */
+    static const uint8_t CHILDREN_COUNT = 20;
+    /* Deepest subdivision whose size can be predicted */
+    static const uint8_t MAX_DEPTH = 8;
+    /* Number of vertices the post-transform cache is assumed to keep when reordering triangles */
+    static const uint32_t VERTEX_CACHE_SIZE = 16;
+
+private:
+    std::vector<uint8_t> apparentFacesIndices[ALL_FACES + 1];
+    MeshSize subtreeSizes[MAX_DEPTH + 1][ALL_FACES + 1];
 
 public:
+
     Sponge();
 
     /**
@@ -48,100 +125,272 @@ public:
     *        bottom left, bottom right).
     *        The second face must be given in the same order as the first one (e.g : if the first point given for the first
     *        face was the top left one, the second face must start with the top left one adn so on.)
-    * @param vertices is an empty vector where the subdivision will be written to
-    * @param indices is an empty vector where the indices describing the faces will be written to
+    * @param vertices is where the subdivision will be written to, it is resized to the predicted size and keeps
+    *        enough capacity for duplicateVertices
+    * @param indices is a vector where the indices describing the faces will be written to, it is resized to the
+    *        predicted size
+    * @param arena is the scratch memory of the calling worker
     */
-    void subdivide(uint8_t depth, const vector<float> &parallelepiped, vector<float> &vertices,
-                   vector<uint32_t> &indices);
+    void subdivide(uint8_t depth, const vector<float> &parallelepiped, PointArrays &vertices,
+                   vector<uint32_t> &indices, Arena &arena) const;
+
+    /**
+     * Subdivide only one of the 20 children of the given parallelepiped, stopping at the given depth, and write it
+     * directly at its place in a mesh whose size was predicted.
+     * Writing the 20 children one after the other, each at the offsets given by the sizes of the preceding ones,
+     * gives exactly the result of subdivide.
+     * @param depth is the depth when to stop subdivision, must be greater than 0
+     * @param parallelepiped is a vector of eights points (see subdivide)
+     * @param child is the position of the child in the subdivision order, lower than CHILDREN_COUNT
+     * @param vertices is the mesh the child is written to from firstVertex, room must be left for
+     *        predictSubtreeSize(depth, child).vertices vertices
+     * @param indices is where the first index of the child will be written, room must be left for
+     *        predictSubtreeSize(depth, child).indices indices
+     * @param firstVertex is the position of the child's first vertex in the mesh, also used to shift its indices
+     * @param arena is the scratch memory of the calling worker
+     */
+    void subdivideSubtree(uint8_t depth, const vector<float> &parallelepiped, uint8_t child, PointArrays &vertices,
+                          uint32_t *indices, uint64_t firstVertex, Arena &arena) const;
+
+    /**
+     * Subdivide the unit cube in a Menger Sponge like pattern, giving each vertex by its integer coordinates on the
+     * lattice of the subdivision. Vertices and indices match the ones of subdivide called on the unit cube, a vertex
+     * being exactly its lattice coordinates divided by getLatticeSize(depth), without the drift of successive thirds.
+     * @param depth is the depth when to stop subdivision, at most MAX_DEPTH
+     * @param vertices is a vector where the lattice coordinates will be written to, it is resized to the predicted size
+     * @param indices is a vector where the indices describing the faces will be written to, it is resized to the
+     *        predicted size
+     */
+    void subdivideLattice(uint8_t depth, vector<uint16_t> &vertices, vector<uint32_t> &indices) const;
+
+    /**
+     * Give the cubes of the integer lattice kept after subdividing the unit cube a number of times, in the order their
+     * subtrees have in subdivideLattice
+     * @param depth is the depth when to stop subdivision, at most MAX_DEPTH
+     * @param level is the number of subdivisions to apply, at most depth
+     * @param cubes is a vector where the 20 to the power of level cubes will be written to
+     */
+    void splitLattice(uint8_t depth, uint8_t level, vector<LatticeCube> &cubes) const;
+
+    /**
+     * Give the leaves of the next depth from the leaves of a sponge: each leaf is subdivided once more, on the lattice
+     * of the next depth which is 3 times finer
+     * @param leaves are the leaves of a sponge, in the order of subdivideLattice (see splitLattice)
+     * @param children is a vector where the 20 children of each leaf will be written to, in the same order
+     */
+    void refineLattice(const vector<LatticeCube> &leaves, vector<LatticeCube> &children) const;
+
+    /**
+     * Write the mesh of consecutive leaves of the integer lattice, each one right after the previous one, the way
+     * subdivideLattice writes them
+     * @param leaves is an array of count leaves (see splitLattice)
+     * @param count is the number of leaves
+     * @param vertices is where the lattice coordinates of the first leaf will be written, room must be left for
+     *        64 vertices per leaf
+     * @param indices is where the first index of the first leaf will be written, room must be left for the
+     *        predicted size of each leaf
+     * @param firstVertex is the position of the first leaf's first vertex in the mesh, used to shift its indices
+     * @param cancellation stops the writing early when raised, leaving the mesh incomplete
+     */
+    void subdivideLatticeLeaves(const LatticeCube *leaves, uint64_t count, uint16_t *vertices, uint32_t *indices,
+                                uint64_t firstVertex, const CancellationToken &cancellation) const;
+
+    /**
+     * Subdivide one of the cubes given by splitLattice on the integer lattice (see subdivideLattice)
+     * @param cube is the cube to subdivide
+     * @param vertices is a vector where the lattice coordinates will be written to, it is resized to the predicted size
+     * @param indices is a vector where the indices describing the faces will be written to, starting at 0 for the
+     *        cube's first vertex, it is resized to the predicted size
+     */
+    void subdivideLatticeCube(const LatticeCube &cube, vector<uint16_t> &vertices, vector<uint32_t> &indices) const;
+
+    /**
+     * Give the number of lattice steps along an edge of the unit cube subdivided at the given depth, leaves being
+     * subdivided into thirds once more
+     * @param depth is the depth of the subdivision, at most MAX_DEPTH
+     * @return 3 to the power of depth + 1
+     */
+    static uint16_t getLatticeSize(uint8_t depth);
+
+    /**
+     * Give the exact size of a subdivision without computing it
+     * @param depth is the depth when to stop subdivision, at most MAX_DEPTH
+     * @param apparentFaces is the set of faces of the parallelepiped that are visible
+     * @return
+     */
+    MeshSize predictMeshSize(uint8_t depth, FacesMask apparentFaces = ALL_FACES) const;
+
+    /**
+     * Give the exact size of one of the 20 children of a subdivision (see subdivideSubtree)
+     * @param depth is the depth when to stop subdivision, between 1 and MAX_DEPTH
+     * @param child is the position of the child in the subdivision order
+     * @return
+     */
+    MeshSize predictSubtreeSize(uint8_t depth, uint8_t child) const;
 
     /**
      * Computes normals relative to vertices that will be used for lighting
-     * @param vertices is a vector containing the vertices
+     * @param vertices contains the vertices
      * @param indices is a vector containing indices that describe triangles to draw
-     * @param normals is an empty vector that will contain normal in the same order as the vertices parameter
+     * @param normals will contain the normals in the same order as the vertices parameter
      */
-    static void computeSpongeNormals(const vector<float> &vertices, const vector<uint32_t> &indices,
-                                     vector<float> &normals);
+    static void computeSpongeNormals(const PointArrays &vertices, const vector<uint32_t> &indices,
+                                     PointArrays &normals);
 
     /**
      * Duplicates vertices involve in several faces to avoid lighting issues
-     * @param vertices is a vector containing vertices, will be modified
+     * @param vertices contains the vertices, will be modified
      * @param indices is a vector containing indices that describe triangle, will be modified
+     * @param arena is the scratch memory of the calling worker
      */
-    static void duplicateVertices(vector<float> &vertices, vector<uint32_t> &indices);
+    static void duplicateVertices(PointArrays &vertices, vector<uint32_t> &indices, Arena &arena);
 
-private:
+    /**
+     * Merge the references to a lattice point made by faces of the same orientation into a single vertex, and give
+     * its own vertex to each orientation, so that every vertex still has the normal of its faces.
+     * The quads are split into batches of at most IndexBatch::MAX_VERTICES vertices, so that they are drawn with 16 bit
+     * indices: a lattice point is only merged inside a batch, the next batch gets its own copy. Quads are ordered by
+     * orientation, from 0 to 5, and vertices by first reference, so the vertices end up grouped by orientation too.
+     * Unreferenced vertices are dropped.
+     * @param vertices is a vector containing lattice coordinates (see subdivideLattice)
+     * @param indices is a vector containing indices that describe quads, 6 indices each
+     * @param weldedVertices is a vector where the merged vertices will be written to, as 4 values each: the lattice
+     *        coordinates, then the orientation of their faces (2 * axis, plus 1 if they face the negative side)
+     * @param weldedIndices is a vector where the indices of the quads will be written to, relative to their batch
+     * @param batches is a vector where the batches will be written to
+     * @param arena is the scratch memory of the calling worker
+     * @param cancellation stops the welding early when raised, leaving the welded mesh incomplete
+     */
+    static void weldVertices(const vector<uint16_t> &vertices, const vector<uint32_t> &indices,
+                             vector<uint16_t> &weldedVertices, vector<uint16_t> &weldedIndices,
+                             vector<IndexBatch> &batches, Arena &arena, const CancellationToken &cancellation);
 
     /**
-     * Add the face indicated in parameter at the end the indices vector
-     * @param shift is the shift that need to be applied to base value of indices
-     * (this should be the number of vertices that were in the vector before this batch)
-     * @param indices is a vector containing indices that describe triangle. The new face will be added at the end
-     * @param face is the face that will be added at the end of the indices vector
+     * Reorder the triangles of a welded mesh so that the GPU finds more of their vertices in its post-transform cache,
+     * with the Tipsify algorithm of Sander, Nehab and Barczak: triangles are emitted around a fanning vertex, the next
+     * one being a vertex of the last triangles that is still in the cache and has the fewest triangles left, or else
+     * the last vertex still having some. It runs in linear time.
+     * Triangles only move inside the quads of one orientation of a batch, so that batches and meshlets keep a single
+     * orientation, and batches may be reordered by several workers at once. Vertices are left as they are.
+     * @param vertices is a vector containing the welded vertices (see weldVertices)
+     * @param indices is a vector containing the indices of the triangles, relative to their batch, will be modified
+     * @param batch is the batch whose triangles are reordered
+     * @param arena is the scratch memory of the calling worker
+     * @param cancellation stops the reordering early when raised, leaving some triangles in their former order
      */
-    void addFace(uint64_t shift, vector<uint32_t> &indices, Faces face);
+    static void optimizeVertexCache(const vector<uint16_t> &vertices, vector<uint16_t> &indices,
+                                    const IndexBatch &batch, Arena &arena, const CancellationToken &cancellation);
 
     /**
-     * Add the faces indicated in parameter at the end of the indices vector
-     * @param shift is the shift that need to be applied to base value of indices
-     * (this should be the number of vertices that were in the vector before this batch)
-     * @param indices is a vector containing indices that describe triangle. The new face will be added at the end
-     * @param apparentFaces is a vector containing the faces that needs to be added
+     * Simulate a first in first out post-transform cache drawing the batches of a mesh, the cache being emptied between
+     * batches since they are separate draws
+     * @param indices is a vector containing the indices of the triangles, relative to their batch
+     * @param batches is a vector containing the batches of the mesh
+     * @param cacheSize is the number of vertices kept by the cache
+     * @return the average cache miss ratio: the number of vertices transformed per triangle, from 0.5 at best to 3
      */
-    void addFaces(uint64_t shift, vector<uint32_t> &indices, const vector<Faces> &apparentFaces);
+    static double getAverageCacheMissRatio(const vector<uint16_t> &indices, const vector<IndexBatch> &batches,
+                                           uint32_t cacheSize = VERTEX_CACHE_SIZE);
 
     /**
-     * Subdivide the given line into four equidistant points
-     * @param line is a vector containing two points
-     * @param result is an empty vector where the subdivision will be written to
-    */
-    static void subdivideLine(const vector<float> &line, vector<float> &result);
+     * Split the triangles of a welded mesh into meshlets of at most Meshlet::MAX_TRIANGLES, a meshlet never spanning
+     * two batches nor two orientations. Triangles come 2 by 2 from quads of the same orientation, whatever their order,
+     * and neighbouring triangles stay close once reordered for the cache, so a meshlet mostly covers a patch of one
+     * plane
+     * @param vertices is a vector containing the welded vertices (see weldVertices)
+     * @param indices is a vector containing the indices of the triangles, relative to their batch
+     * @param batches is a vector containing the batches of the mesh
+     * @param meshlets is a vector where the meshlets will be written to
+     */
+    static void buildMeshlets(const vector<uint16_t> &vertices, const vector<uint16_t> &indices,
+                              const vector<IndexBatch> &batches, vector<Meshlet> &meshlets);
 
     /**
-     * Subdivide the given quadrilateral into four equidistant lines.
-     * @param quadrilateral is a vector containing four points
-     * @param result is an empty vector where the subdivision will be written to
+     * Merge the quads lying side by side on a plane of the lattice and facing the same side into rectangles as large
+     * as possible, the way voxel engines mesh their chunks. The surface covered and the orientation of every part of
+     * it are kept, with far fewer quads. Each rectangle gets its own 4 vertices, to be welded afterwards.
+     * @param vertices is a vector containing lattice coordinates (see subdivideLattice), replaced by the corners of
+     *        the rectangles
+     * @param indices is a vector containing indices that describe quads, 6 indices each, replaced by the rectangles
+     * @param latticeSize is the number of lattice steps along an edge of the cube (see getLatticeSize)
+     * @param arena is the scratch memory of the calling worker
+     * @param cancellation stops the merging early when raised, leaving the vectors incomplete
+     */
+    static void mergeCoplanarFaces(vector<uint16_t> &vertices, vector<uint32_t> &indices, uint16_t latticeSize,
+                                   Arena &arena, const CancellationToken &cancellation);
+
+private:
+
+    /**
+     * Write the indices of the faces indicated in parameter
+     * @param shift is the shift that need to be applied to base value of indices
+     * (this should be the number of vertices that precede this batch)
+     * @param indices is where the indices describing the triangles will be written to
+     * @param apparentFaces is the set of faces that needs to be written
      */
-    static void subdivideQuadrilateral(const vector<float> &quadrilateral, vector<float> &result);
+    void addFaces(uint64_t shift, uint32_t *indices, FacesMask apparentFaces) const;
+
+    /**
+     * Write the 20 children of a cube of the integer lattice, in the subdivision order
+     * @param cube is the cube to split, at least 1 level away from the leaves
+     * @param children is where the 20 children will be written to
+     */
+    void splitLatticeCube(const LatticeCube &cube, LatticeCube *children) const;
 
     /**
      * Subdivide the given parallelepiped into four equidistant faces
-     * @param parallelepiped is a vector of eights points given in the following order :
+     * @param parallelepiped is an array of eights points given in the following order :
      *        first face, then opposite face (each face is given in a Z like pattern, e.g : top left, top right,
      *        bottom left, bottom right).
      *        The second face must be given in the same order as the first one (e.g : if the first point given for the first
     *        face was the top left one, the second face must start with the top left one adn so on.)
-    * @param result is an empty vector where the subdivision will be written to
+    * @param result is an array of 3 * 64 floats where the subdivision will be written to, the 64 abscissas, then the
+    *        ordinates, then the heights
     */
-    static void subdivideParallelepiped(const vector<float> &parallelepiped, vector<float> &result);
+    static void subdivideParallelepiped(const float *parallelepiped, float *result);
 
     /**
      * Subdivide the child parallelepiped indicated in parameter in a Menger Sponge like pattern
-     * @param depth is the depth where the subdivision should stop
-     * @param vertices is a vector where the result vertices will be append to
-     * @param indices is a vector where the result faces will be append to
-     * @param parentVertices is a vector containing the vertices of the parent (a subdivided parallelepiped)
-     * @param childIndices is a vector of the 8 vertices that describe the child that will be subdivided
-     * @param parentApparentFaces is a vector indicating which faces of the parent are visible
-     * @param childPossiblyApparentFaces is a vector indicated which faces of the child might be visible
-     * (those faces will not be visible is the parent faces they belong to isn't)
-     * @param childMandatoryFaces is a vector indicated which faces of the child will definitely be visible
-     */
-    void subdivideChild(uint8_t depth, vector<float> &vertices, vector<uint32_t> &indices,
-                        const vector<float> &parentVertices, const vector<uint8_t> &childIndices,
-                        const vector<Faces> &parentApparentFaces, const vector<Faces> &childPossiblyApparentFaces,
-                        const vector<Faces> &childMandatoryFaces);
+     * @param depth is the depth of the parent
+     * @param parentVertices is an array containing the 64 vertices of the parent (see subdivideParallelepiped)
+     * @param child describes the 8 vertices of the child that will be subdivided
+     * @param childApparentFaces is the set of faces of the child that are visible
+     * @param vertices is the mesh the result vertices will be written to, from firstVertex
+     * @param indices is where the result faces will be written to
+     * @param firstVertex is the position in the mesh of the first vertex written
+     * @param arena is the scratch memory of the calling worker
+     */
+    void subdivideChild(uint8_t depth, const float *parentVertices, const ChildDescription &child,
+                        FacesMask childApparentFaces, PointArrays &vertices, uint32_t *indices, uint64_t firstVertex,
+                        Arena &arena) const;
 
     /**
      * Recursive function that will subdivide a parallelepiped into a Menger sponge like pattern
      * @param depth is the depth where to stop the subdivision
-     * @param parallelepiped is a vector containing 8 vertices that describe the parallelepiped that will be subdivide
-     * @param vertices is a vector where the result vertices will be append to
-     * @param indices is a vector where the result faces will be append to
-     * @param parentApparentFaces is a vector indicating which faces of the parent are visible
+     * @param parallelepiped is an array containing 8 vertices that describe the parallelepiped that will be subdivide
+     * @param parentApparentFaces is the set of faces of the parallelepiped that are visible
+     * @param vertices is the mesh the result vertices will be written to from firstVertex, the subtree size having
+     *        been predicted
+     * @param indices is where the result faces will be written to, the subtree size having been predicted
+     * @param firstVertex is the position in the mesh of the first vertex written
+     * @param arena is the scratch memory of the calling worker
+     */
+    void recursiveSubdivide(uint8_t depth, const float *parallelepiped, FacesMask parentApparentFaces,
+                            PointArrays &vertices, uint32_t *indices, uint64_t firstVertex, Arena &arena) const;
+
+    /**
+     * Recursive function that will subdivide a cube of the integer lattice into a Menger sponge like pattern
+     * @param depth is the depth where to stop the subdivision
+     * @param origin is the lattice point of the cube's first corner
+     * @param size is the number of lattice steps along the cube's edges
+     * @param parentApparentFaces is the set of faces of the cube that are visible
+     * @param vertices is where the result lattice coordinates will be written to
+     * @param indices is where the result faces will be written to
+     * @param firstVertex is the position in the mesh of the first vertex written
      */
-    void recursiveSubdivide(uint8_t depth, const vector<float> &parallelepiped, vector<float> &vertices,
-                            vector<uint32_t> &indices, const vector<Faces> &parentApparentFaces);
+    void recursiveSubdivideLattice(uint8_t depth, const uint16_t *origin, uint16_t size,
+                                   FacesMask parentApparentFaces, uint16_t *vertices, uint32_t *indices,
+                                   uint64_t firstVertex) const;
 
 };
 
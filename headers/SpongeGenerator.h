@@ -0,0 +1,272 @@
+#ifndef FRACTALS_PLATONIC4D_SPONGEGENERATOR_H
+#define FRACTALS_PLATONIC4D_SPONGEGENERATOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CancellationToken.h"
+#include "ChunkStore.h"
+#include "Sponge.h"
+
+using namespace std;
+
+/**
+ * Sponge of a hypercube cell given in cell space: each vertex is given by its coordinates on the lattice of the unit
+ * cube subdivision, so the same sponge fits every cell whatever the rotations are.
+ * Coplanar faces are merged into rectangles, then vertices are welded on the lattice: a vertex is shared by the faces
+ * of a single orientation.
+ */
+struct CellSponge {
+    uint8_t depth = 0;
+    /* Number of lattice steps along an edge of the cell */
+    uint16_t latticeSize = 1;
+    /* 4 values per vertex: its lattice coordinates, then the orientation of its faces. Vertices are grouped by
+     * orientation (see Sponge::weldVertices) */
+    vector<uint16_t> vertices;
+    /* Triangles in batches drawn with 16 bit indices, each index being relative to the first vertex of its batch */
+    vector<uint16_t> indices;
+    vector<IndexBatch> batches;
+    /* Quads grouped to be culled together (see Sponge::buildMeshlets) */
+    vector<Meshlet> meshlets;
+};
+
+/**
+ * Generates the sponges of several cells at once, sharing the work between worker threads.
+ * Each cell is split into the 20 subtrees of its first subdivision, every (cell, subtree) pair being a task.
+ * The size of every subtree is predicted, so prefix sums over them give each task its place in the preallocated
+ * cell mesh and the shift to apply to its indices: tasks write directly to their slice and the result is identical
+ * to the serial Sponge::subdivide.
+ * The helper threads live as long as the generator, they sleep between batches of jobs instead of being created and
+ * joined for each one.
+ */
+class SpongeGenerator {
+private:
+    /**
+     * Jobs given to runConcurrently, shared by the calling thread and the helpers that join it
+     */
+    struct Batch {
+        const function<void(uint32_t, uint32_t)> *job;
+        uint32_t jobCount;
+        atomic<uint32_t> nextJob;
+        /* Threads working on the batch, the batch is over when it drops to 0 */
+        uint32_t workerCount;
+        /* Helpers only join a background batch when no other batch has jobs left */
+        bool background;
+        exception_ptr failure;
+    };
+
+    /**
+     * Subdivision of one subtree of a cell
+     */
+    struct Task {
+        uint8_t cell;
+        uint8_t child;
+        /* Position of the task's first vertex and first index inside the cell mesh */
+        uint64_t firstVertex;
+        uint64_t firstIndex;
+    };
+
+    /**
+     * Consecutive leaves of the cell sponge written by one job
+     */
+    struct LeafRange {
+        uint64_t firstLeaf;
+        uint64_t leafCount;
+        /* Position of the range's first vertex and first index inside the cell mesh */
+        uint64_t firstVertex;
+        uint64_t firstIndex;
+    };
+
+    Sponge sponge;
+    uint32_t threadCount;
+    vector<Arena> arenas;
+    vector<Task> tasks;
+    /* Lattice coordinates and indices of the cell sponge before welding, freed once it is generated */
+    vector<uint16_t> lattice;
+    vector<uint32_t> latticeIndices;
+    /* Leaves of the last cell sponge, kept to refine them for the next depth */
+    vector<LatticeCube> leaves;
+    vector<LatticeCube> refinedLeaves;
+    uint8_t leavesDepth = 0;
+    vector<LeafRange> leafRanges;
+    /* Chunk being generated by each worker, and its lattice coordinates and indices before welding */
+    vector<CellSponge> workerChunks;
+    vector<vector<uint16_t>> workerLattices;
+    vector<vector<uint32_t>> workerLatticeIndices;
+    /* Helper threads, waiting for batches of jobs. Every member below is guarded by batchesMutex */
+    vector<thread> helpers;
+    mutex batchesMutex;
+    condition_variable batchesChanged;
+    vector<Batch *> batches;
+    bool stopping = false;
+
+public:
+    /**
+     * @param threadCount is the number of threads working on a generation, 0 uses every hardware thread
+     */
+    explicit SpongeGenerator(uint32_t threadCount = 0);
+
+    /**
+     * Stop and join the helper threads, no batch may be running
+     */
+    ~SpongeGenerator();
+
+    SpongeGenerator(const SpongeGenerator &) = delete;
+
+    SpongeGenerator &operator=(const SpongeGenerator &) = delete;
+
+    /**
+     * Generate the sponge of each given parallelepiped, then duplicate its vertices and compute its normals
+     * @param depth is the depth when to stop subdivision
+     * @param parallelepipeds is an array of cells (see Sponge::subdivide)
+     * @param count is the number of cells
+     * @param vertices is an array of count meshes where each cell's vertices will be written to
+     * @param indices is an array of count vectors where each cell's indices will be written to
+     * @param normals is an array of count meshes where each cell's normals will be written to
+     */
+    void generate(uint8_t depth, const vector<float> *parallelepipeds, uint8_t count, PointArrays *vertices,
+                  vector<uint32_t> *indices, PointArrays *normals);
+
+    /**
+     * Generate the sponge of a cell in cell space, it only needs to be done once per depth (see project).
+     * The leaves are kept: when the next call is for the next depth, they are subdivided once more instead of
+     * subdividing the cell again from the start
+     * @param depth is the depth when to stop subdivision
+     * @param cellSponge is where the sponge will be written to
+     * @param cancellation stops the generation early when raised
+     * @return true if the sponge was generated, false if it was cancelled, cellSponge then being left empty
+     */
+    bool generateCellSponge(uint8_t depth, CellSponge &cellSponge, const CancellationToken &cancellation);
+
+    /**
+     * Generate the sponge of a cell in cell space the way generateCellSponge does, but one chunk at a time, each worker
+     * writing the chunks it made to a file instead of keeping the whole sponge in memory. Chunks hold subtrees of
+     * ChunkStore::CHUNK_DEPTH, vertices are only welded inside a chunk.
+     * @param depth is the depth when to stop subdivision
+     * @param store is where the chunks will be written to, it is opened for the depth
+     * @param cancellation stops the generation early when raised
+     * @return true if every chunk was written, false if it was cancelled, some chunks then never becoming ready
+     */
+    bool generateChunks(uint8_t depth, ChunkStore &store, const CancellationToken &cancellation);
+
+    /**
+     * Place a sponge generated in cell space in each of the given 4D cells, then project it to 3D and compute its
+     * normals. This is all that needs to be done when the cells are rotated.
+     * It doesn't use the generation buffers, so it may run while another thread generates a cell sponge.
+     * @param cellSponge is the sponge to place in each cell
+     * @param corners is an array of count * 8 points, the 8 corners of each cell (in the order of the unit cube
+     *        corners given to Sponge::subdivide, each cell being an affine image of the unit cube)
+     * @param count is the number of cells
+     * @param cameraOffset4D is the position of the camera on the W axis
+     * @param vertices is an array of count meshes where each cell's projected vertices will be written to
+     * @param normals is an array of count meshes where each cell's normals will be written to, or nullptr when the
+     *        faces are shaded flat and only need their positions
+     */
+    void project(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count, float cameraOffset4D,
+                 PointArrays *vertices, PointArrays *normals);
+
+    /**
+     * Project the way project does, for a result that may never be needed: the helpers only join it when no other
+     * batch has jobs left, and it stops between cells when cancelled
+     * @param cellSponge is the sponge to place in each cell
+     * @param corners is an array of count * 8 points, the 8 corners of each cell (see project)
+     * @param count is the number of cells
+     * @param cameraOffset4D is the position of the camera on the W axis
+     * @param vertices is an array of count meshes where each cell's projected vertices will be written to
+     * @param normals is an array of count meshes where each cell's normals will be written to, or nullptr to skip them
+     * @param cancellation stops the projection early when raised
+     * @return true if every cell was projected, false if it was cancelled, some cells then being left incomplete
+     */
+    bool projectInBackground(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count,
+                             float cameraOffset4D, PointArrays *vertices, PointArrays *normals,
+                             const CancellationToken &cancellation);
+
+    /**
+     * @return the number of threads working on a generation
+     */
+    uint32_t getThreadCount() const;
+
+private:
+    /**
+     * Run jobs on up to threadCount threads, the calling thread being one of them and the idle helpers joining it.
+     * Several threads may run batches at once (a projection while a sponge is generated), the helpers then share
+     * themselves between them. The calling thread is always worker 0, so only one of them may use the workers' buffers.
+     * If a job throws, the remaining jobs are abandoned and the first exception is re-thrown once every thread ended.
+     * @param jobCount is the number of jobs
+     * @param job is called with the job number and the number of the worker running it
+     * @param background is true if the helpers should prefer the other batches to this one
+     */
+    void runConcurrently(uint32_t jobCount, const function<void(uint32_t, uint32_t)> &job, bool background = false);
+
+    /**
+     * Take the jobs of a batch one after the other until there are none left
+     * @param batch is the batch to work on
+     * @param worker is the number of the calling worker
+     */
+    void workOn(Batch &batch, uint32_t worker);
+
+    /**
+     * Loop of a helper thread: wait for a batch with jobs left, work on it, and again until the generator is destroyed
+     * @param worker is the number of the helper, from 1 to threadCount - 1
+     */
+    void runHelper(uint32_t worker);
+
+    /**
+     * Project a cell sponge in each cell (see project and projectInBackground)
+     * @return false if it was cancelled
+     */
+    bool projectCells(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count, float cameraOffset4D,
+                      PointArrays *vertices, PointArrays *normals, const CancellationToken &cancellation,
+                      bool background);
+
+    /**
+     * Split each cell into one task per subtree of its first subdivision, and place each task in its cell mesh
+     * @param depth is the depth when to stop subdivision
+     * @param count is the number of cells
+     */
+    void planTasks(uint8_t depth, uint8_t count);
+
+    /**
+     * Split the leaves into ranges of consecutive leaves, and place each range in the cell mesh
+     * @return the size of the cell mesh
+     */
+    MeshSize planLeafRanges();
+
+    /**
+     * Subdivide each given parallelepiped, one task per subtree, without duplicating vertices
+     * @param depth is the depth when to stop subdivision
+     * @param parallelepipeds is an array of cells (see Sponge::subdivide)
+     * @param count is the number of cells
+     * @param vertices is an array of count meshes where each cell's vertices will be written to
+     * @param indices is an array of count vectors where each cell's indices will be written to
+     */
+    void subdivideCells(uint8_t depth, const vector<float> *parallelepipeds, uint8_t count, PointArrays *vertices,
+                        vector<uint32_t> *indices);
+
+    /**
+     * Rotate and project the vertices of a cell sponge and give their normals in a single pass: the cell being an
+     * affine image of the unit cube, a vertex is the first corner plus its coordinates times the 3 edges of the cell,
+     * it is then projected from the camera on the W axis. Its normal follows from the orientation of its faces and
+     * the projected edges, without reading the other vertices of its faces: the vertices are grouped by orientation,
+     * each group is projected with the terms of its normal. Each coordinate is written to its own array, so that the
+     * loop stores whole registers
+     * @param cellVertices is an array of count vertices given in cell space (see CellSponge)
+     * @param latticeSize is the number of lattice steps along an edge of the cell
+     * @param count is the number of vertices
+     * @param corners is an array containing the 8 corners of the cell
+     * @param cameraOffset4D is the position of the camera on the W axis
+     * @param vertices is a mesh of count vertices where the projection will be written to
+     * @param normals is a mesh of count vertices where their normals will be written to, or nullptr to skip them
+     */
+    static void projectCell(const uint16_t *cellVertices, uint16_t latticeSize, uint64_t count,
+                            const glm::vec4 *corners, float cameraOffset4D, PointArrays &vertices,
+                            PointArrays *normals);
+};
+
+#endif //FRACTALS_PLATONIC4D_SPONGEGENERATOR_H
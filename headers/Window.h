@@ -6,15 +6,26 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <mutex>
 #include <thread>
 #include <time.h>
 
+#include "DepthScheduler.h"
+#include "DoubleBuffer.h"
+#include "DragPredictor.h"
 #include "Hypercube.h"
-#include "Sponge.h"
+#include "LruCache.h"
+#include "Mailbox.h"
+#include "MeshletCuller.h"
+#include "SpongeGenerator.h"
 #include "Menu.h"
 
 using namespace std;
@@ -34,7 +45,8 @@ enum VAO_ID {
     NW = 7,
     WIRE_MESH = 8,
     OVERLAY = 9,
-    NUMBER = 10,
+    CELL_SPONGE = 10,
+    NUMBER = 11,
 };
 
 /**
@@ -46,9 +58,123 @@ enum TEXTURE_ID {
     NUMBER_TEXTURE = 1,
 };
 
+/**
+ * Batches of a sponge mesh on the GPU (see IndexBatch), in the arrays glMultiDrawElementsBaseVertex takes: each batch
+ * has its count of 16 bit indices, their offset in the index buffer and the position of its first vertex
+ */
+struct BatchedDraw {
+    vector<GLsizei> counts;
+    vector<const void *> offsets;
+    vector<GLint> baseVertices;
+};
+
+/**
+ * Chunk of a sponge kept in a file (see ChunkStore) that was uploaded to the GPU
+ */
+struct ResidentChunk {
+    uint32_t chunk;
+    uint32_t vertexArray;
+    uint32_t vertexBuffer;
+    uint32_t indexBuffer;
+    uint64_t bytes;
+    /* Last frame where the chunk was visible */
+    uint64_t lastVisibleFrame;
+    BatchedDraw draw;
+};
+
 static const float PI = glm::pi<float>();
 static const float PI2 = 2.0f * glm::pi<float>();
 
+/**
+ * Request made to the sponge worker
+ */
+struct SpongeRequest {
+    /* Depth of the sponge to generate, as a cell sponge or in chunks if it is deeper than the GPU can hold at once */
+    uint8_t depth;
+};
+
+/**
+ * Rotations a projection was made for, the 6 rotation gauges being rounded to a step of the cache quantization so that
+ * going back to a gauge position finds the projection again
+ */
+struct RotationKey {
+    /* Steps of the quantization over the range of a gauge */
+    static const uint16_t QUANTIZATION = 4096;
+
+    uint16_t rotations[6];
+    uint8_t depth;
+    /* Flat shaded projections have no normals */
+    bool flatShading;
+
+    bool operator==(const RotationKey &other) const {
+        return depth == other.depth && flatShading == other.flatShading &&
+               equal(rotations, rotations + 6, other.rotations);
+    }
+};
+
+/**
+ * Hash of a rotation key, for the projection cache
+ */
+struct RotationKeyHash {
+    size_t operator()(const RotationKey &key) const {
+        /* Every field is mixed in, so that the depths and shadings of one rotation land in different buckets */
+        uint64_t hash = 0;
+        for (uint16_t rotation: key.rotations) {
+            hash ^= rotation + 0x9e3779b97f4a7c15ull + (hash << 6u) + (hash >> 2u);
+        }
+        hash ^= key.depth + 0x9e3779b97f4a7c15ull + (hash << 6u) + (hash >> 2u);
+        hash ^= key.flatShading + 0x9e3779b97f4a7c15ull + (hash << 6u) + (hash >> 2u);
+        return hash;
+    }
+};
+
+/**
+ * Request made to the projection worker
+ */
+struct ProjectionRequest {
+    /* Rotations of the request, its projection is cached under them */
+    RotationKey key;
+    /* Requests and cached projections displayed are numbered, a projection older than the one displayed is dropped */
+    uint64_t sequence;
+    /* Sponge to project, kept alive by the request even if another one is displayed meanwhile */
+    shared_ptr<const CellSponge> cellSponge;
+    /* Rotated 4D corners of each cube, in the order of cubesIndices */
+    glm::vec4 corners[8 * 8];
+    float cameraOffset4D;
+};
+
+/**
+ * Request made to the speculation worker: the positions a dragged gauge is predicted to reach next, whose
+ * projections aren't cached yet
+ */
+struct SpeculationRequest {
+    shared_ptr<const CellSponge> cellSponge;
+    /* Raised when the drag leaves the predicted positions, each drag has its own */
+    shared_ptr<CancellationToken> cancellation;
+    uint8_t count;
+    RotationKey keys[DragPredictor::PREDICTION_COUNT];
+    /* Rotated 4D corners of each cube at each position, in the order of cubesIndices */
+    glm::vec4 corners[DragPredictor::PREDICTION_COUNT][8 * 8];
+    float cameraOffset4D;
+};
+
+/**
+ * Cell sponge projected in each cube by the projection worker
+ */
+struct ProjectedSponge {
+    /* Sponge that was projected, its indices go with the vertices */
+    shared_ptr<const CellSponge> cellSponge;
+    PointArrays vertices[8];
+    /* Left empty when the faces are shaded flat */
+    PointArrays normals[8];
+    /* Rotated 4D corners of each cube it was projected in, in the order of cubesIndices */
+    glm::vec4 corners[8 * 8];
+    /* Time the projection took */
+    double projectionMilliseconds;
+    /* Number of the request it was made for */
+    uint64_t sequence;
+};
+
 /**
  * Wrapping class for hypercube data management and OpenGL API interaction
  */
@@ -63,6 +189,8 @@ private:
     static double scroll_speed;
     static bool leftButtonPressed;
     static bool wire_mesh;
+    static bool gpuProjection;
+    static bool flatShading;
 
     glm::vec3 cameraPosition{};
 
@@ -82,17 +210,112 @@ private:
     uint32_t programMain = 0, programTexture = 0;
     uint32_t VAO[VAO_ID::NUMBER]{}, VBO[VAO_ID::NUMBER]{}, NBO[VAO_ID::NUMBER]{}, IBO[VAO_ID::NUMBER]{};
     vector<vector<uint8_t>> cubesIndices;
-    vector<float> points[VAO_ID::NUMBER]{};
+    PointArrays points[VAO_ID::NUMBER]{};
     vector<float> vertices[VAO_ID::NUMBER]{};
-    vector<float> normals[VAO_ID::NUMBER]{};
     uint32_t currentIndicesCount[VAO_ID::NUMBER]{};
+    /* Sponges are drawn in batches of 16 bit indices instead */
+    BatchedDraw spongeDraws[VAO_ID::NUMBER];
     vector<uint32_t> indices[VAO_ID::NUMBER]{};
 
-    Sponge sponge;
+    SpongeGenerator spongeGenerator;
+    /* Sponge placed in every cube, and the one of the next depth being generated by the worker. A sponge is shared
+     * with the projections made from it, the worker is given a new one for each depth */
+    shared_ptr<CellSponge> cellSponge{new CellSponge()};
+    shared_ptr<CellSponge> nextCellSponge{new CellSponge()};
+    bool cellSpongeUploaded = false;
+    /* Projection worker, alive as long as the window. It projects the latest request posted to its mailbox into the
+     * back copy of the projected sponge, the render thread uploads the front copy once it is published */
+    thread projectionWorker;
+    Mailbox<ProjectionRequest> projectionRequests;
+    DoubleBuffer<ProjectedSponge> projectedSponges;
+    mutex projectionWorkerMutex;
+    condition_variable projectionWorkerWakeUp;
+    bool projectionWorkerStopping = false;
+    /* Sponge whose indices are on the GPU for the CPU projection, whether its normals are there too and the corners
+     * of the cubes it was projected in, which lag behind the rotations while the projection worker is busy */
+    shared_ptr<const CellSponge> uploadedProjectionSponge;
+    bool uploadedProjectionNormals = false;
+    glm::vec4 uploadedProjectionCorners[8 * 8];
+    /* While a gauge is dragged, the CPU projection displays the deepest sponge that is projected and uploaded within
+     * the latency budget, from the timings measured on this machine. The sponges of every depth it displays are
+     * kept for that, the full depth is projected again once the gauge is released or held still for idleDelay */
+    DepthScheduler depthScheduler{50.0};
+    shared_ptr<const CellSponge> cpuCellSponges[Sponge::MAX_DEPTH + 1];
+    chrono::steady_clock::time_point lastRotationTime;
+    chrono::milliseconds idleDelay{250};
+    /* Depth of the last projection requested */
+    uint8_t projectedDepth = 0;
+    /* Projections of the rotations seen recently, made by the projection worker. Going back to one of them (a gauge
+     * dragged back and forth, the reset button) displays it on the next frame instead of projecting it again */
+    LruCache<RotationKey, ProjectedSponge, RotationKeyHash> projectionCache{512ull << 20u};
+    /* Number of the last projection requested or found in the cache, and of the last one found in the cache: the
+     * projections published by the worker for older requests are dropped */
+    uint64_t projectionSequence = 0;
+    uint64_t cachedProjectionSequence = 0;
+    /* Speculation worker, alive as long as the window. While a gauge is dragged, it projects the full depth sponge at
+     * the positions the drag is predicted to reach into the projection cache, its batches only getting the helpers
+     * the other workers leave idle. Its request is cancelled when the drag leaves the predicted positions */
+    DragPredictor dragPredictor;
+    thread speculationWorker;
+    Mailbox<SpeculationRequest> speculationRequests;
+    mutex speculationWorkerMutex;
+    condition_variable speculationWorkerWakeUp;
+    bool speculationWorkerStopping = false;
+    shared_ptr<CancellationToken> speculationCancellation;
+    /* Positions predicted by the last request, cached or not */
+    RotationKey speculatedKeys[DragPredictor::PREDICTION_COUNT];
+    uint8_t speculatedKeyCount = 0;
+    atomic<uint64_t> speculationsCompleted{0};
+    atomic<uint64_t> speculationsCancelled{0};
     uint8_t spongeDepth = 1;
     uint8_t maxSpongeDepth = 3;
-    thread *spongeWorker = nullptr;
-    bool spongeWorkerHasFinished = true;
+    /* The GPU projection only stores the compact cell sponge once, which allows deeper sponges */
+    uint8_t maxGpuSpongeDepth = 4;
+    /* Deeper sponges don't fit in memory, they are written to a file in chunks that are paged to the GPU when they
+     * are visible */
+    uint8_t maxChunkedSpongeDepth = 5;
+    unique_ptr<ChunkStore> chunkStore{new ChunkStore()};
+    unique_ptr<ChunkStore> nextChunkStore{new ChunkStore()};
+    bool chunkedSponge = false;
+    /* Chunks on the GPU, then for each chunk its position among them (-1 if it isn't on the GPU), the cubes it is
+     * visible in and its distance to the camera */
+    vector<ResidentChunk> residentChunks;
+    vector<int32_t> chunkResidency;
+    vector<uint8_t> chunkVisibility;
+    vector<float> chunkDistances;
+    uint64_t residentChunkBytes = 0;
+    uint64_t chunkMemoryBudget = 2ull << 30u;
+    uint64_t chunkUploadBudget = 64ull << 20u;
+    uint64_t frameNumber = 0;
+    /* The meshlets of the cell sponge drawn in a cube that can't be seen are skipped, the ranges of the others are
+     * drawn. What was culled is reported every cullingReportInterval frames */
+    MeshletCuller meshletCuller;
+    vector<IndexBatch> visibleRanges;
+    BatchedDraw visibleDraw;
+    glm::mat4 viewProjection{1.0f};
+    uint32_t culledFrames = 0;
+    uint32_t cullingReportInterval = 256;
+    double cullingMilliseconds = 0.0;
+    /* Sponge worker, alive as long as the window. It sleeps until a request is posted to its mailbox, generates the
+     * sponge of the latest one and hands it over by raising spongeWorkerHasFinished, with spongeWorkerSucceeded
+     * telling if the sponge is complete */
+    thread spongeWorker;
+    Mailbox<SpongeRequest> spongeRequests;
+    mutex spongeWorkerMutex;
+    condition_variable spongeWorkerWakeUp;
+    bool spongeWorkerStopping = false;
+    atomic<bool> spongeWorkerHasFinished{false};
+    bool spongeWorkerSucceeded = false;
+    double spongeGenerationMilliseconds = 0.0;
+    /* A request was posted and its sponge wasn't handed over yet, only used by the render thread */
+    bool spongeRequestPending = false;
+    /* Depth that couldn't be generated (the disk is full for instance), it isn't requested again */
+    uint8_t failedSpongeDepth = UINT8_MAX;
+    /* Raised when the sponge the worker generates isn't needed anymore, lowered before each new request. The
+     * worker notes when it ended so that the time it took to stop can be reported */
+    CancellationToken spongeCancellation;
+    chrono::steady_clock::time_point spongeCancellationTime;
+    chrono::steady_clock::time_point spongeWorkerEndTime;
     bool vertexComputationUpdated = false;
 
     glm::vec3 unfoldAxis[VAO_ID::NUMBER]{};
@@ -160,9 +383,155 @@ private:
     void create3DCube(VAO_ID ID);
 
     /**
-     * Uses the VAOs points array to create vertices, indices and normals
+     * Loop of the sponge worker: wait for a request, generate its sponge, and again until the window is closed
+     */
+    void runSpongeWorker();
+
+    /**
+     * Ask the sponge worker for the sponge of a depth, without waiting for it: update shows the sponge once it is
+     * handed over
+     * @param depth is the depth of the sponge
+     */
+    void requestSponge(uint8_t depth);
+
+    /**
+     * Generate the sponge of a cube in cell space, run by the sponge worker
+     * @param depth is the depth of the sponge
+     * @return true if the sponge was generated, false if it was cancelled or failed
+     */
+    bool computeCellSponge(uint8_t depth);
+
+    /**
+     * Ask the sponge worker to stop the sponge it generates, without waiting for it: update collects it once the
+     * worker has ended, the render loop is never held up by a sponge that is no longer wanted
+     */
+    void cancelSpongeWorker();
+
+    /**
+     * Ask the projection worker to place the cell sponge in each of the rotated 4D cubes and project it to 3D, without
+     * waiting for it: update uploads the projection once it is published.
+     * While a gauge is dragged, a shallower sponge is projected if the depth scheduler expects the current one to
+     * exceed the latency budget. A projection found in the cache is uploaded at once instead, the full depth first
+     */
+    void projectCellSponge();
+
+    /**
+     * Loop of the projection worker: wait for a request and for the previous projection to be taken, project the
+     * sponge, cache it, and again until the window is closed
+     */
+    void runProjectionWorker();
+
+    /**
+     * Give the key of the current rotations in the projection cache
+     * @param depth is the depth of the projected sponge
+     * @return the key
+     */
+    RotationKey getRotationKey(uint8_t depth) const;
+
+    /**
+     * Give the key of some rotations in the projection cache
+     * @param rotations is an array of the 6 rotation gauge values
+     * @param depth is the depth of the projected sponge
+     * @return the key
+     */
+    static RotationKey getRotationKey(const float *rotations, uint8_t depth);
+
+    /**
+     * @param rotations is an array where the 6 rotation gauge values will be written to
+     */
+    static void getRotations(float *rotations);
+
+    /**
+     * Reset the hypercube, then apply the rotations of the gauges to it
+     * @param rotations is an array of the 6 rotation gauge values
+     */
+    void rotateHypercube(const float *rotations);
+
+    /**
+     * Predict the next positions of the dragged gauge and ask the speculation worker to project the ones that aren't
+     * cached, without waiting for it. The previous request is cancelled if the drag didn't reach one of its positions
+     * @param rotations is an array of the 6 rotation gauge values after the last move
+     */
+    void speculate(const float *rotations);
+
+    /**
+     * Cancel the request the speculation worker works on, without waiting for it
+     */
+    void cancelSpeculation();
+
+    /**
+     * Loop of the speculation worker: wait for a request, project each of its positions into the projection cache
+     * unless it is cancelled, and again until the window is closed
+     */
+    void runSpeculationWorker();
+
+    /**
+     * Report the hit rate and the memory use of the projection cache, every 64 lookups
+     */
+    void logProjectionCache() const;
+
+    /**
+     * Send a projected sponge to the GPU, it is drawn from then on
+     * @param projection is the projected sponge
+     */
+    void uploadProjection(const ProjectedSponge &projection);
+
+    /**
+     * Wake up a worker sleeping on a condition variable, without missing it if it is about to sleep
+     * @param workerMutex is the mutex the worker sleeps with
+     * @param wakeUp is the condition variable the worker sleeps on
+     */
+    static void wakeWorker(mutex &workerMutex, condition_variable &wakeUp);
+
+    /**
+     * @return true if the user is dragging a gauge and moved it within idleDelay
+     */
+    bool isInteracting() const;
+
+    /**
+     * Display the sponge kept by the worker in place of the current one
+     */
+    void showNextCellSponge();
+
+    /**
+     * Display the sponge the worker wrote in chunks in place of the current one, it is only displayed by the GPU
+     * projection
+     */
+    void showNextChunkedSponge();
+
+    /**
+     * Find the chunks of the chunked sponge that are visible in each cube, then upload the closest ones that aren't
+     * on the GPU yet within the upload budget of a frame, evicting the chunks that weren't visible for the longest
+     * time to stay within the GPU memory budget
+     * @param viewProjection is the view and projection matrix of the frame
+     */
+    void pageChunks(const glm::mat4 &viewProjection);
+
+    /**
+     * Give the map from the unit cube of cell space to world space of a cube: its cell is placed in 4D, projected
+     * from the camera on the W axis and moved by the model matrix, in homogeneous coordinates
+     * @param corners is an array containing the 8 rotated 4D corners of the cube, in the order of cubesIndices
+     * @param ID of the cube
+     * @param drawIndex is the draw index of the cube (see drawVAOContents), which scales its W slightly
+     * @return the map
+     */
+    glm::mat4 getCellToWorld(const glm::vec4 *corners, VAO_ID ID, int32_t drawIndex) const;
+
+    /**
+     * Report the meshlets culled per frame and the time culling them took, every cullingReportInterval frames
+     */
+    void logCulling();
+
+    /**
+     * Remove the chunk that wasn't visible for the longest time from the GPU, unless it is visible in this frame
+     * @return true if a chunk was removed
      */
-    void computeVertexArray();
+    bool evictChunk();
+
+    /**
+     * Remove every chunk from the GPU
+     */
+    void releaseChunks();
 
     /**
      * Update the hypercube representation, updating the rotations if needed
@@ -173,15 +542,17 @@ private:
 
     /**
      * Transform the hypercube by the new rotations parameters and re-compute the individual cubes
-     * Then resets depth to 1 and launch a sponge computing thread
+     * Then re-project the current sponge, keeping its depth
      */
     void updateRotations();
 
     /**
      * Load vertices, normals and indices to buffers
      * @param ID of the VAO used to store the data
+     * @param projection is the projected sponge holding the vertices and normals of the cube
+     * @param uploadIndices is true if the indices of the projected sponge aren't on the GPU yet
     */
-    void fillSpongeVertexArray(VAO_ID ID);
+    void fillSpongeVertexArray(VAO_ID ID, const ProjectedSponge &projection, bool uploadIndices);
 
     /**
      * Load vertices, normals and indices to buffers
@@ -189,6 +560,47 @@ private:
     */
     void fillWireMeshVertexArray();
 
+    /**
+     * Load the cell sponge, given in cell space, to the buffers shared by every cube when the projection is done on
+     * the GPU
+     */
+    void fillCellSpongeVertexArray();
+
+    /**
+     * Load a sponge given in cell space to a vertex array and its buffers
+     * @param vertexArray is the vertex array to set up
+     * @param vertexBuffer receives the vertices, 4 unsigned shorts each (see CellSponge)
+     * @param indexBuffer receives the indices
+     * @param vertices is an array of vertexCount vertices
+     * @param vertexCount is the number of vertices
+     * @param indices is an array of indexCount indices, relative to their batch
+     * @param indexCount is the number of indices
+     */
+    static void fillLatticeVertexArray(uint32_t vertexArray, uint32_t vertexBuffer, uint32_t indexBuffer,
+                                       const uint16_t *vertices, uint64_t vertexCount, const uint16_t *indices,
+                                       uint64_t indexCount);
+
+    /**
+     * Give the draw of a mesh whose indices were uploaded in batches
+     * @param draw is where the draw will be written to
+     * @param batches is an array of batchCount batches
+     * @param batchCount is the number of batches
+     */
+    static void setBatches(BatchedDraw &draw, const IndexBatch *batches, uint64_t batchCount);
+
+    /**
+     * Draw the triangles of the bound vertex array, every batch in a single call
+     * @param draw is the draw of the mesh
+     */
+    static void drawBatches(const BatchedDraw &draw);
+
+    /**
+     * Load points to the bound array buffer as x, y, z triplets, interleaving their coordinates straight into the
+     * buffer memory
+     * @param points are the points to load
+     */
+    static void bufferPoints(const PointArrays &points);
+
     /**
      * Initialize overlay texture buffer and position vertices
      */
@@ -223,10 +635,18 @@ private:
     static void loadUniform1i(uint32_t program, const char *name, int32_t value);
 
     /**
-     * Binds the selected VAO and draw it's content
+     * Give the model matrix of a cube, which unfolds the hypercube
+     * @param ID of the cube
+     * @return
+     */
+    glm::mat4 getCubeModel(VAO_ID ID) const;
+
+    /**
+     * Binds the selected VAO and draw it's content, without the meshlets of the sponge that can't be seen
      * @param ID of the VAO to draw
+     * @param drawIndex moves very slightly the cubes drawn later towards the camera, to avoid overlapping
      */
-    void drawVAOContents(VAO_ID ID);
+    void drawVAOContents(VAO_ID ID, int32_t drawIndex);
 
     /**
      * Compute distances between each cube's center of mass and the camera
@@ -5,6 +5,7 @@ in vec4 vColor;
 in vec3 vNormal;
 
 uniform mat4 model;
+uniform bool flatShading; // the faces are flat, their normal is given by the screen space derivatives of the position
 
 out vec4 FragColor;
 
@@ -25,7 +26,12 @@ void main() {
 
     vec3 result = 0.4f * vec3(1.0f, 1.0f, 1.0f); // ambiant light
 
-    vec3 norm = normalize(transpose(inverse(mat3(model))) * (gl_FrontFacing ? 1 : -1) * vNormal);
+    vec3 norm;
+    if (flatShading) {
+        norm = normalize(cross(dFdx(fragPos), dFdy(fragPos))); // fragPos is already in world space, facing the camera
+    } else {
+        norm = normalize(transpose(inverse(mat3(model))) * (gl_FrontFacing ? 1 : -1) * vNormal);
+    }
     for (uint i = 0; i < 2; ++i) {
         vec3 lightDir = normalize(lights[i].pos - fragPos); // vector between source and fragment position
         float diff = max(dot(norm, lightDir), 0.0f); // diffusion component
@@ -2,6 +2,7 @@
 
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
+layout (location = 2) in float face; // orientation of the face in cell space: 2 * axis, plus 1 on the negative side
 
 uniform mat4 model;
 uniform mat4 view;
@@ -10,14 +11,48 @@ uniform mat4 projection;
 uniform vec4 color;
 uniform int drawIndex;
 
+uniform bool projectFrom4D; // position is given on the lattice of the cell and must be placed in the 4D cell
+uniform float latticeSize; // number of lattice steps along an edge of the cell
+uniform mat4 rotation; // 4D rotation of the hypercube
+uniform float cameraOffset4D; // position of the camera on the W axis
+uniform vec4 cellCorners[4]; // first corner of the cell, then the corners at the end of its X, Y and Z edges
+uniform bool flatShading; // the fragment shader derives the normal of the face, there is none to compute
+
 out vec3 fragPos;
 out vec4 vColor;
 out vec3 vNormal;
 
 void main() {
+    vec3 vertex = position;
+    vec3 vertexNormal = normal;
+    if (projectFrom4D) {
+        // the cell is an affine image of the unit cube, rotate its first corner and its edges
+        vec4 origin = rotation * cellCorners[0];
+        vec4 edgeX = rotation * (cellCorners[1] - cellCorners[0]);
+        vec4 edgeY = rotation * (cellCorners[2] - cellCorners[0]);
+        vec4 edgeZ = rotation * (cellCorners[3] - cellCorners[0]);
+        vec3 cellPosition = position / latticeSize;
+        vec4 point = origin + cellPosition.x * edgeX + cellPosition.y * edgeY + cellPosition.z * edgeZ;
+        vertex = point.xyz / (cameraOffset4D - point.w); // project from the camera on the W axis
+
+        if (!flatShading) {
+            // faces are aligned with the edges of the cell
+            int orientation = int(face);
+            vec3 cellNormal = vec3(0.0f);
+            cellNormal[orientation / 2] = orientation % 2 == 0 ? 1.0f : -1.0f;
+
+            // derivatives of the projection along the edges (up to a positive factor), their cofactors map the normal
+            vec3 tangentX = edgeX.xyz + vertex * edgeX.w;
+            vec3 tangentY = edgeY.xyz + vertex * edgeY.w;
+            vec3 tangentZ = edgeZ.xyz + vertex * edgeZ.w;
+            vertexNormal = cellNormal.x * cross(tangentY, tangentZ) + cellNormal.y * cross(tangentZ, tangentX)
+                         + cellNormal.z * cross(tangentX, tangentY);
+        }
+    }
+
     float w =  1.0f + (drawIndex / 10000.0f); // used to move very slightly each cube's vertices using back to front ordering to avoid overlapping
-    gl_Position = projection * view * model * vec4(position, w); // compute mvp matrix and apply to the vertex position
-    fragPos = vec3(model * vec4(position, w)); // calculate only the fragment position for the fragment shader
-    vNormal = normal; // pass normal to the fragment shader
+    gl_Position = projection * view * model * vec4(vertex, w); // compute mvp matrix and apply to the vertex position
+    fragPos = vec3(model * vec4(vertex, w)); // calculate only the fragment position for the fragment shader
+    vNormal = vertexNormal; // pass normal to the fragment shader
     vColor = color;
 }
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include "../headers/Arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t blockSize) : blockSize(blockSize) {}
+
+Arena::Mark Arena::mark() const {
+    return {currentBlock, offset};
+}
+
+void Arena::release(const Mark &mark) {
+    currentBlock = mark.block;
+    offset = mark.offset;
+}
+
+void Arena::reset() {
+    currentBlock = 0;
+    offset = 0;
+}
+
+void Arena::trim() {
+    size_t keptBlocks = offset == 0 ? currentBlock : currentBlock + 1;
+    /* Without its current block, the next allocation requests a new one (see allocateBytes) */
+    if (keptBlocks < blocks.size()) {
+        blocks.resize(keptBlocks);
+    }
+}
+
+uint64_t Arena::getBlockAllocations() const {
+    return blockAllocations;
+}
+
+void *Arena::allocateBytes(size_t size, size_t alignment) {
+    while (currentBlock < blocks.size()) {
+        /* Align the offset inside the current block and check if the request fits */
+        size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+        if (aligned + size <= blocks[currentBlock].size) {
+            offset = aligned + size;
+            return blocks[currentBlock].data.get() + aligned;
+        }
+        /* Try the next block that was kept from a previous computation */
+        ++currentBlock;
+        offset = 0;
+    }
+
+    /* Every block is exhausted, request a new one big enough for this allocation
+     * (blocks come from operator new, so their start is suitably aligned for any fundamental type) */
+    size_t newBlockSize = max(blockSize, size);
+    blocks.push_back({unique_ptr<uint8_t[]>(new uint8_t[newBlockSize]), newBlockSize});
+    ++blockAllocations;
+    currentBlock = blocks.size() - 1;
+    offset = size;
+    return blocks[currentBlock].data.get();
+}
@@ -0,0 +1,19 @@
+#include "../headers/CancellationToken.h"
+
+using namespace std;
+
+CancellationToken::CancellationToken() : cancelled(false) {}
+
+void CancellationToken::cancel() {
+    /* Nothing is published with the flag: the job's results are handed over by the worker's own synchronization, a
+     * sequentially consistent flag raised once it ended or a mailbox, whatever the job read of the token */
+    cancelled.store(true, memory_order_relaxed);
+}
+
+void CancellationToken::reset() {
+    cancelled.store(false, memory_order_relaxed);
+}
+
+bool CancellationToken::isCancelled() const {
+    return cancelled.load(memory_order_relaxed);
+}
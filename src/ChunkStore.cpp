@@ -0,0 +1,129 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../headers/ChunkStore.h"
+
+using namespace std;
+
+ChunkStore::ChunkStore() : usedBytes(0) {}
+
+ChunkStore::~ChunkStore() {
+    close();
+}
+
+void ChunkStore::open(uint8_t depth, const vector<LatticeCube> &cubes, uint64_t capacity) {
+    close();
+
+    /* Create a file with a unique name in the temporary directory, then remove its name right away: the file lives
+     * as long as it is open */
+    const char *directory = getenv("TMPDIR");
+    string path = string(directory != nullptr ? directory : "/tmp") + "/fractals-sponge-XXXXXX";
+    file = mkstemp(&path[0]);
+    if (file < 0) throw runtime_error("Can't create the sponge file " + path + ": " + strerror(errno));
+    unlink(path.c_str());
+
+    /* Size the file without writing it, then map it */
+    if (ftruncate(file, (off_t) capacity) != 0) {
+        string error = strerror(errno);
+        close();
+        throw runtime_error("Can't size the sponge file to " + to_string(capacity) + " bytes: " + error);
+    }
+    void *mapping = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapping == MAP_FAILED) {
+        string error = strerror(errno);
+        close();
+        throw runtime_error("Can't map the sponge file: " + error);
+    }
+    data = static_cast<uint8_t *>(mapping);
+    this->capacity = capacity;
+    usedBytes = 0;
+
+    chunks.assign(cubes.size(), {});
+    ready.reset(new atomic<bool>[cubes.size()]);
+    for (uint32_t chunk = 0; chunk < cubes.size(); ++chunk) {
+        chunks[chunk].cube = cubes[chunk];
+        ready[chunk] = false;
+    }
+    this->depth = depth;
+    latticeSize = Sponge::getLatticeSize(depth);
+}
+
+void ChunkStore::close() {
+    if (data != nullptr) {
+        munmap(data, capacity);
+        data = nullptr;
+    }
+    if (file >= 0) {
+        ::close(file);
+        file = -1;
+    }
+    capacity = 0;
+    usedBytes = 0;
+    chunks.clear();
+    ready.reset();
+    depth = 0;
+    latticeSize = 1;
+}
+
+void ChunkStore::write(uint32_t chunk, const vector<uint16_t> &vertices, const vector<uint16_t> &indices,
+                       const vector<IndexBatch> &batches) {
+    /* Reserve the place of the chunk. Vertices take 8 bytes and quads 12 bytes of indices, so every chunk and its
+     * batches keep the alignment of the batches */
+    uint64_t vertexBytes = vertices.size() * sizeof(uint16_t);
+    uint64_t indexBytes = indices.size() * sizeof(uint16_t);
+    uint64_t batchBytes = batches.size() * sizeof(IndexBatch);
+    uint64_t offset = usedBytes.fetch_add(vertexBytes + indexBytes + batchBytes);
+    if (offset + vertexBytes + indexBytes + batchBytes > capacity) throw length_error("The sponge file is full");
+
+    memcpy(data + offset, vertices.data(), vertexBytes);
+    memcpy(data + offset + vertexBytes, indices.data(), indexBytes);
+    memcpy(data + offset + vertexBytes + indexBytes, batches.data(), batchBytes);
+    chunks[chunk].offset = offset;
+    chunks[chunk].vertexCount = vertices.size() / 4;
+    chunks[chunk].indexCount = indices.size();
+    chunks[chunk].batchCount = batches.size();
+    /* Publish the chunk once it is complete */
+    ready[chunk].store(true, memory_order_release);
+}
+
+bool ChunkStore::isReady(uint32_t chunk) const {
+    return ready[chunk].load(memory_order_acquire);
+}
+
+const SpongeChunk &ChunkStore::getChunk(uint32_t chunk) const {
+    return chunks[chunk];
+}
+
+const uint16_t *ChunkStore::getVertices(const SpongeChunk &chunk) const {
+    return reinterpret_cast<const uint16_t *>(data + chunk.offset);
+}
+
+const uint16_t *ChunkStore::getIndices(const SpongeChunk &chunk) const {
+    return reinterpret_cast<const uint16_t *>(data + chunk.offset + chunk.vertexCount * 4 * sizeof(uint16_t));
+}
+
+const IndexBatch *ChunkStore::getBatches(const SpongeChunk &chunk) const {
+    return reinterpret_cast<const IndexBatch *>(getIndices(chunk) + chunk.indexCount);
+}
+
+uint32_t ChunkStore::getChunkCount() const {
+    return chunks.size();
+}
+
+uint8_t ChunkStore::getDepth() const {
+    return depth;
+}
+
+uint16_t ChunkStore::getLatticeSize() const {
+    return latticeSize;
+}
+
+uint64_t ChunkStore::getUsedBytes() const {
+    return usedBytes;
+}
@@ -0,0 +1,64 @@
+#include "../headers/DepthScheduler.h"
+
+using namespace std;
+
+DepthScheduler::DepthScheduler(double budget) : budget(budget) {}
+
+void DepthScheduler::recordGeneration(uint8_t depth, double milliseconds) {
+    addMeasure(timings[depth].generation, milliseconds);
+}
+
+void DepthScheduler::recordProjection(uint8_t depth, double milliseconds) {
+    addMeasure(timings[depth].projection, milliseconds);
+}
+
+void DepthScheduler::recordUpload(uint8_t depth, double milliseconds) {
+    addMeasure(timings[depth].upload, milliseconds);
+}
+
+double DepthScheduler::estimateLatency(uint8_t depth) const {
+    /* Scale the deepest measured depth at or above this one */
+    double scale = 1.0;
+    for (int16_t measured = depth; measured >= 0; --measured) {
+        const DepthTimings &measuredTimings = timings[measured];
+        if (measuredTimings.projection >= 0.0 && measuredTimings.upload >= 0.0) {
+            return (measuredTimings.projection + measuredTimings.upload) * scale;
+        }
+        scale *= Sponge::CHILDREN_COUNT;
+    }
+    return 0.0;
+}
+
+uint8_t DepthScheduler::chooseDepth(bool interacting, uint8_t shallowest, uint8_t deepest) {
+    chosenDepth = deepest;
+    if (interacting) {
+        while (chosenDepth > shallowest && estimateLatency(chosenDepth) > budget) {
+            --chosenDepth;
+        }
+    }
+    return chosenDepth;
+}
+
+double DepthScheduler::getBudget() const {
+    return budget;
+}
+
+uint8_t DepthScheduler::getChosenDepth() const {
+    return chosenDepth;
+}
+
+double DepthScheduler::getGenerationMilliseconds(uint8_t depth) const {
+    return timings[depth].generation;
+}
+
+double DepthScheduler::getProjectionMilliseconds(uint8_t depth) const {
+    return timings[depth].projection;
+}
+
+double DepthScheduler::getUploadMilliseconds(uint8_t depth) const {
+    return timings[depth].upload;
+}
+
+void DepthScheduler::addMeasure(double &average, double milliseconds) {
+    average = average < 0.0 ? milliseconds : average + SMOOTHING * (milliseconds - average);
+}
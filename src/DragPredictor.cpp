@@ -0,0 +1,25 @@
+#include "../headers/DragPredictor.h"
+
+using namespace std;
+
+void DragPredictor::record(const float *newRotations) {
+    for (uint8_t rotation = 0; rotation < 6; ++rotation) {
+        velocity[rotation] = dragging ? newRotations[rotation] - rotations[rotation] : 0.0f;
+        rotations[rotation] = newRotations[rotation];
+    }
+    dragging = true;
+}
+
+void DragPredictor::reset() {
+    dragging = false;
+}
+
+bool DragPredictor::predict(uint8_t step, float *predictedRotations) const {
+    bool moving = false;
+    for (uint8_t rotation = 0; rotation < 6; ++rotation) {
+        predictedRotations[rotation] = rotations[rotation] + (float) step * velocity[rotation];
+        if (predictedRotations[rotation] < 0.0f || predictedRotations[rotation] > 1.0f) return false;
+        moving = moving || velocity[rotation] != 0.0f;
+    }
+    return dragging && moving;
+}
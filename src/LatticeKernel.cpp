@@ -0,0 +1,169 @@
+#include "../headers/LatticeKernel.h"
+
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LATTICE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/* Trilinear weights factor into one weight per axis: a point i thirds of the way along an edge weighs thirds[i] of
+ * its far end. Each coordinate of the lattice is interpolated one axis at a time with them, 4 lines along the first
+ * axis, then their 2 edges across the third for each layer, then the 4 rows across the second, rather than summing the
+ * 8 weighted corners of every point */
+alignas(16) static const float thirds[4] = {0.0f, 1.0f / 3.0f, 2.0f / 3.0f, 1.0f};
+
+LatticeKernel::Path LatticeKernel::path = LatticeKernel::detectPath();
+void (*LatticeKernel::kernel)(const float *, float *, float *, float *) =
+        LatticeKernel::path == LatticeKernel::AVX2 ? &LatticeKernel::evaluateAvx2 :
+        LatticeKernel::path == LatticeKernel::SSE ? &LatticeKernel::evaluateSse : &LatticeKernel::evaluateScalar;
+
+void LatticeKernel::evaluate(const float *corners, float *x, float *y, float *z) {
+    kernel(corners, x, y, z);
+}
+
+bool LatticeKernel::isSupported(Path path) {
+#ifdef LATTICE_KERNEL_X86
+    /* The path is detected while static variables are initialized, possibly before the CPU model was read */
+    __builtin_cpu_init();
+    switch (path) {
+        case AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case SSE:
+            return __builtin_cpu_supports("sse2");
+        default:
+            return path == SCALAR;
+    }
+#else
+    return path == SCALAR;
+#endif
+}
+
+void LatticeKernel::setPath(Path path) {
+    if (!isSupported(path)) {
+        throw invalid_argument(string("The ") + getPathName(path) + " lattice kernel isn't supported by this CPU");
+    }
+    LatticeKernel::path = path;
+    kernel = path == AVX2 ? &evaluateAvx2 : path == SSE ? &evaluateSse : &evaluateScalar;
+}
+
+LatticeKernel::Path LatticeKernel::getPath() {
+    return path;
+}
+
+const char *LatticeKernel::getPathName(Path path) {
+    switch (path) {
+        case AVX2:
+            return "AVX2";
+        case SSE:
+            return "SSE";
+        default:
+            return "scalar";
+    }
+}
+
+LatticeKernel::Path LatticeKernel::detectPath() {
+    return isSupported(AVX2) ? AVX2 : isSupported(SSE) ? SSE : SCALAR;
+}
+
+void LatticeKernel::evaluateScalar(const float *corners, float *x, float *y, float *z) {
+    float *const points[3] = {x, y, z};
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        /* Lines along the first axis, between corners 0 and 1, 2 and 3, 4 and 5, 6 and 7 */
+        float lines[4][4];
+        for (uint8_t line = 0; line < 4; ++line) {
+            const float start = corners[6 * line + axis], end = corners[6 * line + 3 + axis];
+            for (uint8_t point = 0; point < 4; ++point) {
+                lines[line][point] = start + thirds[point] * (end - start);
+            }
+        }
+        for (uint8_t layer = 0; layer < 4; ++layer) {
+            /* The 2 edges of the layer across the second axis, then its 4 rows between them */
+            float edges[2][4];
+            for (uint8_t point = 0; point < 4; ++point) {
+                edges[0][point] = lines[0][point] + thirds[layer] * (lines[2][point] - lines[0][point]);
+                edges[1][point] = lines[1][point] + thirds[layer] * (lines[3][point] - lines[1][point]);
+            }
+            for (uint8_t row = 0; row < 4; ++row) {
+                for (uint8_t point = 0; point < 4; ++point) {
+                    points[axis][16 * layer + 4 * row + point] =
+                            edges[0][point] + thirds[row] * (edges[1][point] - edges[0][point]);
+                }
+            }
+        }
+    }
+}
+
+#ifdef LATTICE_KERNEL_X86
+
+/**
+ * Interpolate the 2 edges across the second axis of every layer of one coordinate of the lattice, a row of 4 points
+ * per register
+ * @param corners is an array of the 8 corners of the hexahedron
+ * @param axis is the coordinate to interpolate
+ * @param starts is where the first edge of each layer will be written to
+ * @param differences is where the second edge minus the first one of each layer will be written to
+ */
+__attribute__((target("sse2")))
+static inline void interpolateEdges(const float *corners, uint8_t axis, __m128 starts[4], __m128 differences[4]) {
+    const __m128 weights = _mm_load_ps(thirds);
+    __m128 lines[4];
+    for (uint8_t line = 0; line < 4; ++line) {
+        const __m128 start = _mm_set1_ps(corners[6 * line + axis]), end = _mm_set1_ps(corners[6 * line + 3 + axis]);
+        lines[line] = _mm_add_ps(start, _mm_mul_ps(weights, _mm_sub_ps(end, start)));
+    }
+    const __m128 firstDifference = _mm_sub_ps(lines[2], lines[0]), secondDifference = _mm_sub_ps(lines[3], lines[1]);
+    for (uint8_t layer = 0; layer < 4; ++layer) {
+        const __m128 weight = _mm_set1_ps(thirds[layer]);
+        starts[layer] = _mm_add_ps(lines[0], _mm_mul_ps(weight, firstDifference));
+        differences[layer] = _mm_sub_ps(_mm_add_ps(lines[1], _mm_mul_ps(weight, secondDifference)), starts[layer]);
+    }
+}
+
+__attribute__((target("sse2")))
+void LatticeKernel::evaluateSse(const float *corners, float *x, float *y, float *z) {
+    float *const points[3] = {x, y, z};
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        __m128 starts[4], differences[4];
+        interpolateEdges(corners, axis, starts, differences);
+        for (uint8_t layer = 0; layer < 4; ++layer) {
+            for (uint8_t row = 0; row < 4; ++row) {
+                _mm_storeu_ps(points[axis] + 16 * layer + 4 * row,
+                              _mm_add_ps(starts[layer], _mm_mul_ps(_mm_set1_ps(thirds[row]), differences[layer])));
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void LatticeKernel::evaluateAvx2(const float *corners, float *x, float *y, float *z) {
+    /* The rows hold half of the work, they are interpolated 2 at a time from an edge repeated in both halves */
+    const __m256 firstWeights = _mm256_setr_m128(_mm_set1_ps(thirds[0]), _mm_set1_ps(thirds[1]));
+    const __m256 secondWeights = _mm256_setr_m128(_mm_set1_ps(thirds[2]), _mm_set1_ps(thirds[3]));
+    float *const points[3] = {x, y, z};
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        __m128 starts[4], differences[4];
+        interpolateEdges(corners, axis, starts, differences);
+        for (uint8_t layer = 0; layer < 4; ++layer) {
+            const __m256 start = _mm256_setr_m128(starts[layer], starts[layer]);
+            const __m256 difference = _mm256_setr_m128(differences[layer], differences[layer]);
+            _mm256_storeu_ps(points[axis] + 16 * layer, _mm256_fmadd_ps(firstWeights, difference, start));
+            _mm256_storeu_ps(points[axis] + 16 * layer + 8, _mm256_fmadd_ps(secondWeights, difference, start));
+        }
+    }
+}
+
+#else
+
+void LatticeKernel::evaluateSse(const float *corners, float *x, float *y, float *z) {
+    evaluateScalar(corners, x, y, z);
+}
+
+void LatticeKernel::evaluateAvx2(const float *corners, float *x, float *y, float *z) {
+    evaluateScalar(corners, x, y, z);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../headers/MeshletCuller.h"
+
+using namespace std;
+
+void MeshletCuller::cull(const CellSponge &cellSponge, const glm::mat4 &cellToWorld, const glm::mat4 &viewProjection,
+                         const glm::vec3 &cameraPosition, bool cullBackFaces, vector<IndexBatch> &ranges) {
+    const glm::mat4 latticeToWorld = cellToWorld * glm::scale(glm::mat4(1.0f),
+                                                              glm::vec3(1.0f / (float) cellSponge.latticeSize));
+    const glm::mat4 latticeToClip = viewProjection * latticeToWorld;
+    /* The camera brought back to the lattice, in homogeneous coordinates. A plane of the lattice is mapped to a plane
+     * of world space, and a point of world space with a positive W is on the side of the image plane where its
+     * preimage is on the side of the plane. A degenerate cell gives no inverse, its comparisons below are all false
+     * and nothing is culled for facing away */
+    const glm::vec4 camera = glm::inverse(latticeToWorld) * glm::vec4(cameraPosition, 1.0f);
+
+    ranges.clear();
+    for (const Meshlet &meshlet : cellSponge.meshlets) {
+        ++statistics.meshlets;
+        statistics.triangles += meshlet.indexCount / 3;
+
+        /* The faces on the plane at k along their axis look at the camera when side * (camera[axis] - k * camera.w)
+         * is positive. It is linear in k, so the meshlet looks away when it is negative on its first and last planes */
+        if (cullBackFaces) {
+            const uint8_t axis = meshlet.orientation / 2u;
+            const float side = meshlet.orientation & 1u ? -1.0f : 1.0f;
+            if (side * (camera[axis] - meshlet.lowest[axis] * camera.w) < 0.0f &&
+                side * (camera[axis] - meshlet.highest[axis] * camera.w) < 0.0f) {
+                ++statistics.backFacing;
+                continue;
+            }
+        }
+
+        /* Out of view when the 8 corners of its box are outside of the same clip plane, the corners being the first
+         * one plus any of the 3 sides of the box */
+        const glm::vec4 first =
+                latticeToClip * glm::vec4(meshlet.lowest[0], meshlet.lowest[1], meshlet.lowest[2], 1.0f);
+        glm::vec4 sides[3];
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            sides[axis] = latticeToClip[axis] * (float) (meshlet.highest[axis] - meshlet.lowest[axis]);
+        }
+        uint8_t outside[6] = {0, 0, 0, 0, 0, 0};
+        bool behindCamera = false;
+        for (uint8_t corner = 0; corner < 8; ++corner) {
+            glm::vec4 clip = first;
+            for (uint8_t axis = 0; axis < 3; ++axis) {
+                if (corner & (1u << axis)) clip += sides[axis];
+            }
+            behindCamera |= clip.w <= 0.0f;
+            for (uint8_t axis = 0; axis < 3; ++axis) {
+                outside[2 * axis] += clip[axis] < -clip.w;
+                outside[2 * axis + 1] += clip[axis] > clip.w;
+            }
+        }
+        if (!behindCamera && *max_element(outside, outside + 6) == 8) {
+            ++statistics.offScreen;
+            continue;
+        }
+
+        /* Consecutive meshlets of a batch are drawn as a single range */
+        statistics.drawnTriangles += meshlet.indexCount / 3;
+        const uint32_t firstVertex = cellSponge.batches[meshlet.batch].firstVertex;
+        if (!ranges.empty() && ranges.back().firstVertex == firstVertex &&
+            ranges.back().firstIndex + ranges.back().indexCount == meshlet.firstIndex) {
+            ranges.back().indexCount += meshlet.indexCount;
+        } else {
+            ranges.push_back({firstVertex, meshlet.firstIndex, meshlet.indexCount});
+        }
+    }
+}
+
+const CullingStatistics &MeshletCuller::getStatistics() const {
+    return statistics;
+}
+
+void MeshletCuller::resetStatistics() {
+    statistics = CullingStatistics();
+}
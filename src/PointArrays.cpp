@@ -0,0 +1,67 @@
+#include "../headers/PointArrays.h"
+
+using namespace std;
+
+uint64_t PointArrays::size() const {
+    return coordinates[0].size();
+}
+
+bool PointArrays::empty() const {
+    return coordinates[0].empty();
+}
+
+void PointArrays::resize(uint64_t count) {
+    for (auto &axis : coordinates) {
+        axis.resize(count);
+    }
+}
+
+void PointArrays::reserve(uint64_t count) {
+    for (auto &axis : coordinates) {
+        axis.reserve(count);
+    }
+}
+
+void PointArrays::clear() {
+    for (auto &axis : coordinates) {
+        axis.clear();
+    }
+}
+
+void PointArrays::add(const glm::vec3 &point) {
+    coordinates[0].push_back(point.x);
+    coordinates[1].push_back(point.y);
+    coordinates[2].push_back(point.z);
+}
+
+glm::vec3 PointArrays::get(uint64_t point) const {
+    return {coordinates[0][point], coordinates[1][point], coordinates[2][point]};
+}
+
+void PointArrays::set(uint64_t point, const glm::vec3 &value) {
+    coordinates[0][point] = value.x;
+    coordinates[1][point] = value.y;
+    coordinates[2][point] = value.z;
+}
+
+float *PointArrays::getCoordinates(uint8_t axis) {
+    return coordinates[axis].data();
+}
+
+const float *PointArrays::getCoordinates(uint8_t axis) const {
+    return coordinates[axis].data();
+}
+
+void PointArrays::interleave(float *target) const {
+    const float *x = coordinates[0].data(), *y = coordinates[1].data(), *z = coordinates[2].data();
+    const uint64_t count = size();
+    for (uint64_t point = 0; point < count; ++point) {
+        target[3 * point] = x[point];
+        target[3 * point + 1] = y[point];
+        target[3 * point + 2] = z[point];
+    }
+}
+
+uint64_t PointArrays::getBytes() const {
+    return 3 * size() * sizeof(float);
+}
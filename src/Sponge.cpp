@@ -2,7 +2,81 @@
 
 using namespace std;
 
-bool Sponge::killComputation = false;
+
+/**
+ * The 20 parallelepipeds kept when subdividing a parent into 27, indexed inside the 64 vertices of the parent
+ * subdivision. Faces are possibly apparent when they lie on the parent's surface, and mandatory when they are made
+ * apparent through the holes of the parent.
+ */
+static constexpr ChildDescription childrenDescriptions[20] = {
+        /* X=0, Y=0, Z=2 */
+        {{ 0,  1,  4,  5, 16, 17, 20, 21}, faceBit(Back) | faceBit(Left) | faceBit(Bottom), 0},
+        /* X=1, Y=0, Z=2 */
+        {{ 1,  2,  5,  6, 17, 18, 21, 22}, faceBit(Back) | faceBit(Bottom), faceBit(Top) | faceBit(Front)},
+        /* X=2, Y=0, Z=2 */
+        {{ 2,  3,  6,  7, 18, 19, 22, 23}, faceBit(Back) | faceBit(Bottom) | faceBit(Right), 0},
+        /* X=2, Y=0, Z=1 */
+        {{18, 19, 22, 23, 34, 35, 38, 39}, faceBit(Bottom) | faceBit(Right), faceBit(Top) | faceBit(Left)},
+        /* X=0, Y=0, Z=1 */
+        {{16, 17, 20, 21, 32, 33, 36, 37}, faceBit(Left) | faceBit(Bottom), faceBit(Top) | faceBit(Right)},
+        /* X=0, Y=0, Z=0 */
+        {{32, 33, 36, 37, 48, 49, 52, 53}, faceBit(Left) | faceBit(Bottom) | faceBit(Front), 0},
+        /* X=1, Y=0, Z=0 */
+        {{33, 34, 37, 38, 49, 50, 53, 54}, faceBit(Bottom) | faceBit(Front), faceBit(Top) | faceBit(Back)},
+        /* X=2, Y=0, Z=0 */
+        {{34, 35, 38, 39, 50, 51, 54, 55}, faceBit(Bottom) | faceBit(Front) | faceBit(Right), 0},
+        /* X=2, Y=1, Z=0 */
+        {{38, 39, 42, 43, 54, 55, 58, 59}, faceBit(Front) | faceBit(Right), faceBit(Back) | faceBit(Left)},
+        /* X=0, Y=1, Z=0 */
+        {{36, 37, 40, 41, 52, 53, 56, 57}, faceBit(Front) | faceBit(Left), faceBit(Back) | faceBit(Right)},
+        /* X=0, Y=1, Z=2 */
+        {{ 4,  5,  8,  9, 20, 21, 24, 25}, faceBit(Back) | faceBit(Left), faceBit(Front) | faceBit(Right)},
+        /* X=2, Y=1, Z=2 */
+        {{ 6,  7, 10, 11, 22, 23, 26, 27}, faceBit(Back) | faceBit(Right), faceBit(Front) | faceBit(Left)},
+        /* X=2, Y=2, Z=2 */
+        {{10, 11, 14, 15, 26, 27, 30, 31}, faceBit(Back) | faceBit(Right) | faceBit(Top), 0},
+        /* X=1, Y=2, Z=2 */
+        {{ 9, 10, 13, 14, 25, 26, 29, 30}, faceBit(Back) | faceBit(Top), faceBit(Front) | faceBit(Bottom)},
+        /* X=0, Y=2, Z=2 */
+        {{ 8,  9, 12, 13, 24, 25, 28, 29}, faceBit(Back) | faceBit(Left) | faceBit(Top), 0},
+        /* X=0, Y=2, Z=1 */
+        {{24, 25, 28, 29, 40, 41, 44, 45}, faceBit(Left) | faceBit(Top), faceBit(Bottom) | faceBit(Right)},
+        /* X=2, Y=2, Z=1 */
+        {{26, 27, 30, 31, 42, 43, 46, 47}, faceBit(Right) | faceBit(Top), faceBit(Bottom) | faceBit(Left)},
+        /* X=2, Y=2, Z=0 */
+        {{42, 43, 46, 47, 58, 59, 62, 63}, faceBit(Right) | faceBit(Top) | faceBit(Front), 0},
+        /* X=1, Y=2, Z=0 */
+        {{41, 42, 45, 46, 57, 58, 61, 62}, faceBit(Front) | faceBit(Top), faceBit(Bottom) | faceBit(Back)},
+        /* X=0, Y=2, Z=0 */
+        {{40, 41, 44, 45, 56, 57, 60, 61}, faceBit(Left) | faceBit(Top) | faceBit(Front), 0},
+};
+
+/**
+ * Keep the possibly apparent faces of a child that aren't hidden because of a neighbor of the parent cube, then
+ * indicate which faces will be worth drawing
+ * @param child
+ * @param parentApparentFaces is the set of faces of the parent that are visible
+ * @return the set of faces of the child that are visible
+ */
+static FacesMask getChildApparentFaces(const ChildDescription &child, FacesMask parentApparentFaces) {
+    return (child.possiblyApparentFaces & parentApparentFaces) | child.mandatoryFaces;
+}
+
+/**
+ * Give the side a quad of the integer lattice faces, from the cross product of two of its sides
+ * @param vertices is an array of lattice coordinates
+ * @param quad is the first of the 6 indices of the quad
+ * @return 2 * axis, plus 1 if the quad faces the negative side
+ */
+static uint16_t getLatticeQuadOrientation(const uint16_t *vertices, const uint32_t *quad) {
+    const uint16_t *a = vertices + 3 * quad[0];
+    const uint16_t *b = vertices + 3 * quad[1];
+    const uint16_t *c = vertices + 3 * quad[2];
+    int32_t U[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]}, V[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    int32_t normal[3] = {U[1] * V[2] - U[2] * V[1], U[2] * V[0] - U[0] * V[2], U[0] * V[1] - U[1] * V[0]};
+    uint8_t axis = normal[0] != 0 ? 0 : (normal[1] != 0 ? 1 : 2);
+    return 2u * axis + (normal[axis] < 0);
+}
 
 Sponge::Sponge(){
     frontFaceIndices = { 0,   4,  3,
@@ -115,518 +189,664 @@ Sponge::Sponge(){
                    34, 38, 22,
                    34, 33, 38,
                    33, 37, 38};
-}
-
-void Sponge::subdivide(uint8_t depth, const vector<float> &parallelepiped, vector<float> &vertices,
-                       vector<uint32_t> &indices) {
-    /* Indicates that every single faces are visible by the camera */
-    vector<Faces> apparentFaces = {Back, Bottom, Right, Top, Left, Front};
-    recursiveSubdivide(depth, parallelepiped, vertices, indices, apparentFaces);
-}
 
-void Sponge::computeSpongeNormals(const vector<float> &vertices, const vector<uint32_t> &indices,
-                                  vector<float> &normals) {
-    normals.resize(vertices.size());
-    for (uint32_t i = 0; i < indices.size(); i += 6) {
-        if (Sponge::killComputation) throw WorkerKilled();
-
-        glm::vec3 a(
-                getPointAbscissa(vertices, indices[i]),
-                getPointOrdinate(vertices, indices[i]),
-                getPointHeight(vertices, indices[i])
-        );
-        glm::vec3 b(
-                getPointAbscissa(vertices, indices[i + 1]),
-                getPointOrdinate(vertices, indices[i + 1]),
-                getPointHeight(vertices, indices[i + 1])
-        );
-        glm::vec3 c(
-                getPointAbscissa(vertices, indices[i + 2]),
-                getPointOrdinate(vertices, indices[i + 2]),
-                getPointHeight(vertices, indices[i + 2])
-        );
-        glm::vec3 U = b - a, V = c - a;
-        glm::vec3 normal = {U.y * V.z - U.z * V.y, U.z * V.x - U.x * V.z, U.x * V.y - U.y * V.x};
-
-        for (uint8_t j = 0; j < 6; ++j) {
-            normals[3 * indices[i + j]] = normal.x;
-            normals[3 * indices[i + j] + 1] = normal.y;
-            normals[3 * indices[i + j] + 2] = normal.z;
+    /* Concatenate the indices of every combination of apparent faces once, so that a leaf only has to copy the list
+     * matching its faces */
+    for (FacesMask faces = 0; faces <= ALL_FACES; ++faces) {
+        for (uint8_t face = Back; face <= Front; ++face) {
+            if (faces & faceBit((Faces) face)) {
+                apparentFacesIndices[faces].insert(apparentFacesIndices[faces].end(),
+                                                   faceIndicesList[face]->begin(), faceIndicesList[face]->end());
+            }
         }
+        apparentFacesIndices[faces].insert(apparentFacesIndices[faces].end(), innerParts.begin(), innerParts.end());
     }
-}
-
-void Sponge::duplicateVertices(vector<float> &vertices, vector<uint32_t> &indices) {
-    vector<float> newVertices;
-    uint32_t nextIndex = vertices.size() / 3;
-
-    vector<uint8_t> count(indices.size(), 0);
-    for (uint32_t &index: indices) {
-        if (Sponge::killComputation) throw WorkerKilled();
 
-        ++count[index];
-        if (count[index] > 1) {
-            newVertices.push_back(getPointAbscissa(vertices, index));
-            newVertices.push_back(getPointOrdinate(vertices, index));
-            newVertices.push_back(getPointHeight(vertices, index));
-            index = nextIndex++;
+    /* A leaf holds 64 vertices and the indices of its faces, duplicateVertices then adds a vertex for each index
+     * referencing a vertex that was already referenced before */
+    for (FacesMask faces = 0; faces <= ALL_FACES; ++faces) {
+        bool referenced[64] = {};
+        MeshSize &size = subtreeSizes[0][faces];
+        size = {64, apparentFacesIndices[faces].size(), 0};
+        for (uint8_t index : apparentFacesIndices[faces]) {
+            size.duplicates += referenced[index];
+            referenced[index] = true;
         }
     }
-    vertices.reserve(vertices.size() + newVertices.size());
-    vertices.insert(vertices.end(), newVertices.begin(), newVertices.end());
-}
 
-void Sponge::addFace(uint64_t shift, vector<uint32_t> &indices, Faces face) {
-    /* Add the list of vertices needed to describe the requested face to the indices list
-     * (a shift needs to be applied to compensate for the indices vector not being empty) */
-    for (uint8_t index : *(faceIndicesList[face])) {
-        indices.push_back(index + shift);
+    /* A subtree is the concatenation of its children's subtrees, each child having its own set of apparent faces */
+    for (uint8_t depth = 1; depth <= MAX_DEPTH; ++depth) {
+        for (FacesMask faces = 0; faces <= ALL_FACES; ++faces) {
+            MeshSize &size = subtreeSizes[depth][faces];
+            size = {0, 0, 0};
+            for (const ChildDescription &child : childrenDescriptions) {
+                const MeshSize &childSize = subtreeSizes[depth - 1][getChildApparentFaces(child, faces)];
+                size.vertices += childSize.vertices;
+                size.indices += childSize.indices;
+                size.duplicates += childSize.duplicates;
+            }
+        }
     }
 }
 
-void Sponge::addFaces(uint64_t shift, vector<uint32_t> &indices, const vector<Faces> &apparentFaces) {
-    /* Add each apparent faces */
-    for (Faces face : apparentFaces) {
-        addFace(shift, indices, face);
-    }
+void Sponge::subdivide(uint8_t depth, const vector<float> &parallelepiped, PointArrays &vertices,
+                       vector<uint32_t> &indices, Arena &arena) const {
+    /* Size the outputs once, keeping room for the vertices duplicateVertices will add */
+    MeshSize size = predictMeshSize(depth);
+    vertices.reserve(size.vertices + size.duplicates);
+    vertices.resize(size.vertices);
+    indices.resize(size.indices);
 
-    /* Add the tube made apparent by the holes of the sponge */
-    for (uint8_t index : innerParts) {
-        indices.push_back(index + shift);
-    }
+    /* Indicates that every single faces are visible by the camera */
+    arena.reset();
+    recursiveSubdivide(depth, parallelepiped.data(), ALL_FACES, vertices, indices.data(), 0, arena);
 }
 
-void Sponge::subdivideLine(const vector<float> &line, vector<float> &result) {
-    /* Add the start of the line to the result */
-    addPointToVector(result, line, 0);
-
-    /* Add a point one third of the way between the two points that describe the line */
-    addPointOneThirdOfTheWayToVector(result, line, 0, 1);
+void Sponge::subdivideSubtree(uint8_t depth, const vector<float> &parallelepiped, uint8_t child, PointArrays &vertices,
+                              uint32_t *indices, uint64_t firstVertex, Arena &arena) const {
+    /* Subdivide the root the same way recursiveSubdivide does, but only descend into the requested child */
+    arena.reset();
+    float *subdivisionResult = arena.allocate<float>(192);
+    subdivideParallelepiped(parallelepiped.data(), subdivisionResult);
+    subdivideChild(depth, subdivisionResult, childrenDescriptions[child],
+                   getChildApparentFaces(childrenDescriptions[child], ALL_FACES), vertices, indices, firstVertex,
+                   arena);
+}
 
-    /* Add a point two thirds of the way between the two points that describe the line */
-    addPointOneThirdOfTheWayToVector(result, line, 1, 0);
+void Sponge::subdivideLattice(uint8_t depth, vector<uint16_t> &vertices, vector<uint32_t> &indices) const {
+    MeshSize size = predictMeshSize(depth);
+    vertices.resize(size.vertices * 3);
+    indices.resize(size.indices);
 
-    /* Add the end of the line to the result vector */
-    addPointToVector(result, line, 1);
+    const uint16_t origin[3] = {0, 0, 0};
+    recursiveSubdivideLattice(depth, origin, getLatticeSize(depth), ALL_FACES, vertices.data(), indices.data(), 0);
 }
 
-void Sponge::subdivideQuadrilateral(const vector<float> &quadrilateral, vector<float> &result) {
-    /* Extract the first line from the quad (this is simply a side of the polygon) */
-    {
-        vector<float> line(quadrilateral.begin(), quadrilateral.begin() + 6);
-        subdivideLine(line, result);
+void Sponge::splitLattice(uint8_t depth, uint8_t level, vector<LatticeCube> &cubes) const {
+    cubes.assign(1, {{0, 0, 0}, getLatticeSize(depth), depth, ALL_FACES});
+    vector<LatticeCube> children;
+    for (uint8_t split = 0; split < level; ++split) {
+        /* Replace every cube by its children, in the order recursiveSubdivideLattice writes them */
+        children.resize(cubes.size() * CHILDREN_COUNT);
+        for (uint64_t cube = 0; cube < cubes.size(); ++cube) {
+            splitLatticeCube(cubes[cube], &children[cube * CHILDREN_COUNT]);
+        }
+        cubes.swap(children);
     }
+}
 
-    /* Create two lines between the chosen side and its opposite.
-     * Those lines are parallels and equidistant */
-    {
-        float startOfLineX, startOfLineY, startOfLineZ;
-        startOfLineX = getCoordinateOneThirdOfTheWay(getPointAbscissa(quadrilateral, 0), getPointAbscissa(quadrilateral, 2));
-        startOfLineY = getCoordinateOneThirdOfTheWay(getPointOrdinate(quadrilateral, 0), getPointOrdinate(quadrilateral, 2));
-        startOfLineZ = getCoordinateOneThirdOfTheWay(getPointHeight(quadrilateral, 0), getPointHeight(quadrilateral, 2));
-
-        float endOfLineX, endOfLineY, endOfLineZ;
-        endOfLineX = getCoordinateOneThirdOfTheWay(getPointAbscissa(quadrilateral, 1), getPointAbscissa(quadrilateral, 3));
-        endOfLineY = getCoordinateOneThirdOfTheWay(getPointOrdinate(quadrilateral, 1), getPointOrdinate(quadrilateral, 3));
-        endOfLineZ = getCoordinateOneThirdOfTheWay(getPointHeight(quadrilateral, 1), getPointHeight(quadrilateral, 3));
-
-        vector<float> line = {
-                startOfLineX, startOfLineY, startOfLineZ,
-                endOfLineX, endOfLineY, endOfLineZ,
-        };
-        subdivideLine(line, result);
+void Sponge::refineLattice(const vector<LatticeCube> &leaves, vector<LatticeCube> &children) const {
+    children.resize(leaves.size() * CHILDREN_COUNT);
+    for (uint64_t leaf = 0; leaf < leaves.size(); ++leaf) {
+        /* The lattice of the next depth is 3 times finer, the leaf now spans 9 steps and is one level away from the
+         * leaves */
+        const LatticeCube &cube = leaves[leaf];
+        const LatticeCube refinedCube = {{(uint16_t) (cube.origin[0] * 3), (uint16_t) (cube.origin[1] * 3),
+                                          (uint16_t) (cube.origin[2] * 3)},
+                                         (uint16_t) (cube.size * 3), (uint8_t) (cube.depth + 1), cube.apparentFaces};
+        splitLatticeCube(refinedCube, &children[leaf * CHILDREN_COUNT]);
     }
+}
 
-    {
-        float startOfLineX, startOfLineY, startOfLineZ;
-        startOfLineX = getCoordinateOneThirdOfTheWay(getPointAbscissa(quadrilateral, 2), getPointAbscissa(quadrilateral, 0));
-        startOfLineY = getCoordinateOneThirdOfTheWay(getPointOrdinate(quadrilateral, 2), getPointOrdinate(quadrilateral, 0));
-        startOfLineZ = getCoordinateOneThirdOfTheWay(getPointHeight(quadrilateral, 2), getPointHeight(quadrilateral, 0));
-
+void Sponge::subdivideLatticeLeaves(const LatticeCube *leaves, uint64_t count, uint16_t *vertices, uint32_t *indices,
+                                    uint64_t firstVertex, const CancellationToken &cancellation) const {
+    for (uint64_t leaf = 0; leaf < count; ++leaf) {
+        if (leaf % CancellationToken::CHECK_INTERVAL == 0 && cancellation.isCancelled()) return;
+        recursiveSubdivideLattice(0, leaves[leaf].origin, leaves[leaf].size, leaves[leaf].apparentFaces, vertices,
+                                  indices, firstVertex);
+        const MeshSize &leafSize = subtreeSizes[0][leaves[leaf].apparentFaces];
+        vertices += leafSize.vertices * 3;
+        indices += leafSize.indices;
+        firstVertex += leafSize.vertices;
+    }
+}
 
-        float endOfLineX, endOfLineY, endOfLineZ;
-        endOfLineX = getCoordinateOneThirdOfTheWay(getPointAbscissa(quadrilateral, 3), getPointAbscissa(quadrilateral, 1));
-        endOfLineY = getCoordinateOneThirdOfTheWay(getPointOrdinate(quadrilateral, 3), getPointOrdinate(quadrilateral, 1));
-        endOfLineZ = getCoordinateOneThirdOfTheWay(getPointHeight(quadrilateral, 3), getPointHeight(quadrilateral, 1));
+void Sponge::subdivideLatticeCube(const LatticeCube &cube, vector<uint16_t> &vertices,
+                                  vector<uint32_t> &indices) const {
+    MeshSize size = predictMeshSize(cube.depth, cube.apparentFaces);
+    vertices.resize(size.vertices * 3);
+    indices.resize(size.indices);
+    recursiveSubdivideLattice(cube.depth, cube.origin, cube.size, cube.apparentFaces, vertices.data(),
+                              indices.data(), 0);
+}
 
-        vector<float> line = {
-                startOfLineX, startOfLineY, startOfLineZ,
-                endOfLineX, endOfLineY, endOfLineZ,
-        };
-        subdivideLine(line, result);
+uint16_t Sponge::getLatticeSize(uint8_t depth) {
+    uint16_t size = 3;
+    for (uint8_t i = 0; i < depth; ++i) {
+        size *= 3;
     }
+    return size;
+}
 
-    /* Extract the last line from the quad (this is simply the side opposite to the first side) */
-    {
-        vector<float> line(quadrilateral.begin() + 6, quadrilateral.begin() + 12);
-        subdivideLine(line, result);
-    }
+MeshSize Sponge::predictMeshSize(uint8_t depth, FacesMask apparentFaces) const {
+    if (depth > MAX_DEPTH) throw out_of_range("Sponge depth " + to_string(depth) + " is too deep to be predicted");
+    return subtreeSizes[depth][apparentFaces];
 }
 
-void Sponge::subdivideParallelepiped(const vector<float> &parallelepiped, vector<float> &result) {
-    /* Extract the first face of the polygon */
-    {
-        vector<float> quadrilateral(parallelepiped.begin(), parallelepiped.begin() + 12);
-        subdivideQuadrilateral(quadrilateral, result);
+MeshSize Sponge::predictSubtreeSize(uint8_t depth, uint8_t child) const {
+    return subtreeSizes[depth - 1][getChildApparentFaces(childrenDescriptions[child], ALL_FACES)];
+}
+
+void Sponge::computeSpongeNormals(const PointArrays &vertices, const vector<uint32_t> &indices,
+                                  PointArrays &normals) {
+    normals.resize(vertices.size());
+    const float *x = vertices.getCoordinates(0), *y = vertices.getCoordinates(1), *z = vertices.getCoordinates(2);
+    float *normalX = normals.getCoordinates(0), *normalY = normals.getCoordinates(1);
+    float *normalZ = normals.getCoordinates(2);
+    for (uint64_t i = 0; i < indices.size(); i += 6) {
+        const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        glm::vec3 U(x[b] - x[a], y[b] - y[a], z[b] - z[a]), V(x[c] - x[a], y[c] - y[a], z[c] - z[a]);
+        glm::vec3 normal = {U.y * V.z - U.z * V.y, U.z * V.x - U.x * V.z, U.x * V.y - U.y * V.x};
+
+        for (uint8_t j = 0; j < 6; ++j) {
+            normalX[indices[i + j]] = normal.x;
+            normalY[indices[i + j]] = normal.y;
+            normalZ[indices[i + j]] = normal.z;
+        }
     }
+}
 
-    /* Create two quadrilateral between the chosen face and its opposite.
-    * Those quadrilateral are parallels and equidistant */
-    {
-        float upLeftCornerX, upLeftCornerY, upLeftCornerZ;
-        upLeftCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 0), getPointAbscissa(parallelepiped, 4));
-        upLeftCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 0), getPointOrdinate(parallelepiped, 4));
-        upLeftCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 0), getPointHeight(parallelepiped, 4));
-
-        float upRightCornerX, upRightCornerY, upRightCornerZ;
-        upRightCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 1), getPointAbscissa(parallelepiped, 5));
-        upRightCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 1), getPointOrdinate(parallelepiped, 5));
-        upRightCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 1), getPointHeight(parallelepiped, 5));
-
-        float downLeftCornerX, downLeftCornerY, downLeftCornerZ;
-        downLeftCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 2), getPointAbscissa(parallelepiped, 6));
-        downLeftCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 2), getPointOrdinate(parallelepiped, 6));
-        downLeftCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 2), getPointHeight(parallelepiped, 6));
-
-        float downRightCornerX, downRightCornerY, downRightCornerZ;
-        downRightCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 3), getPointAbscissa(parallelepiped, 7));
-        downRightCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 3), getPointOrdinate(parallelepiped, 7));
-        downRightCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 3), getPointHeight(parallelepiped, 7));
-
-        vector<float> quadrilateral = {
-                upLeftCornerX,    upLeftCornerY,    upLeftCornerZ,
-                upRightCornerX,   upRightCornerY,   upRightCornerZ,
-                downLeftCornerX,  downLeftCornerY,  downLeftCornerZ,
-                downRightCornerX, downRightCornerY, downRightCornerZ,
-        };
-        subdivideQuadrilateral(quadrilateral, result);
+void Sponge::duplicateVertices(PointArrays &vertices, vector<uint32_t> &indices, Arena &arena) {
+    uint32_t vertexCount = vertices.size();
+    arena.reset();
+    uint8_t *count = arena.allocate<uint8_t>(vertexCount);
+    fill(count, count + vertexCount, 0);
+
+    /* First pass counts how many references need their own copy of the vertex, so that the vertices vector is
+     * grown only once */
+    uint32_t duplicatesCount = 0;
+    for (uint32_t index: indices) {
+        if (count[index] > 0) {
+            ++duplicatesCount;
+        } else {
+            count[index] = 1;
+        }
     }
+    vertices.resize(vertices.size() + duplicatesCount);
 
-    /* Create two quadrilateral between the chosen face and its opposite.
-    * Those quadrilateral are parallels and equidistant */
-    {
-        float upLeftCornerX, upLeftCornerY, upLeftCornerZ;
-        upLeftCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 4), getPointAbscissa(parallelepiped, 0));
-        upLeftCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 4), getPointOrdinate(parallelepiped, 0));
-        upLeftCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 4), getPointHeight(parallelepiped, 0));
-
-        float upRightCornerX, upRightCornerY, upRightCornerZ;
-        upRightCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 5), getPointAbscissa(parallelepiped, 1));
-        upRightCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 5), getPointOrdinate(parallelepiped, 1));
-        upRightCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 5), getPointHeight(parallelepiped, 1));
-
-        float downLeftCornerX, downLeftCornerY, downLeftCornerZ;
-        downLeftCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 6), getPointAbscissa(parallelepiped, 2));
-        downLeftCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 6), getPointOrdinate(parallelepiped, 2));
-        downLeftCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 6), getPointHeight(parallelepiped, 2));
-
-        float downRightCornerX, downRightCornerY, downRightCornerZ;
-        downRightCornerX = getCoordinateOneThirdOfTheWay(getPointAbscissa(parallelepiped, 7), getPointAbscissa(parallelepiped, 3));
-        downRightCornerY = getCoordinateOneThirdOfTheWay(getPointOrdinate(parallelepiped, 7), getPointOrdinate(parallelepiped, 3));
-        downRightCornerZ = getCoordinateOneThirdOfTheWay(getPointHeight(parallelepiped, 7), getPointHeight(parallelepiped, 3));
-
-        vector<float> quadrilateral = {
-                upLeftCornerX,    upLeftCornerY,    upLeftCornerZ,
-                upRightCornerX,   upRightCornerY,   upRightCornerZ,
-                downLeftCornerX,  downLeftCornerY,  downLeftCornerZ,
-                downRightCornerX, downRightCornerY, downRightCornerZ,
-        };
-        subdivideQuadrilateral(quadrilateral, result);
+    /* Second pass redirects the indices to the copies after the original vertices, remembering what each copy is
+     * copied from */
+    uint32_t *sources = arena.allocate<uint32_t>(duplicatesCount);
+    fill(count, count + vertexCount, 0);
+    uint32_t nextIndex = vertexCount;
+    for (uint32_t &index: indices) {
+        if (count[index] > 0) {
+            sources[nextIndex - vertexCount] = index;
+            index = nextIndex++;
+        } else {
+            count[index] = 1;
+        }
     }
 
-    /* Extract the last quadrilateral from the parallelepiped (this is simply the face opposite to the first face) */
-    {
-        vector<float> quadrilateral(parallelepiped.begin() + 12, parallelepiped.begin() + 24);
-        subdivideQuadrilateral(quadrilateral, result);
+    /* The copies are written one coordinate array at a time, so that each loop only reads from one of them */
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        float *coordinates = vertices.getCoordinates(axis);
+        for (uint32_t duplicate = 0; duplicate < duplicatesCount; ++duplicate) {
+            coordinates[vertexCount + duplicate] = coordinates[sources[duplicate]];
+        }
     }
 }
 
-void Sponge::subdivideChild(uint8_t depth, vector<float> &vertices, vector<uint32_t> &indices,
-                            const vector<float> &parentVertices, const vector<uint8_t> &childIndices,
-                            const vector<Faces> &parentApparentFaces, const vector<Faces> &childPossiblyApparentFaces,
-                            const vector<Faces> &childMandatoryFaces) {
+void Sponge::weldVertices(const vector<uint16_t> &vertices, const vector<uint32_t> &indices,
+                          vector<uint16_t> &weldedVertices, vector<uint16_t> &weldedIndices,
+                          vector<IndexBatch> &batches, Arena &arena, const CancellationToken &cancellation) {
+    /* Open addressing table from a lattice point and a face orientation to the merged vertex. A quad has 4 distinct
+     * corners, so there are at most as many merged vertices as slots: quads sharing no corner would fill the table.
+     * The quads of a sponge share most of their corners, which keeps it about half full (40 to 56% at depths 0 to 4),
+     * a table sized for the worst case would take twice the memory at depth 4 */
+    const uint64_t quadCount = indices.size() / 6;
+    uint64_t capacity = 2;
+    uint8_t capacityBits = 1;
+    while (capacity * 3 < indices.size() * 2) {
+        capacity *= 2;
+        ++capacityBits;
+    }
+    arena.reset();
+    uint64_t *keys = arena.allocate<uint64_t>(capacity);
+    uint32_t *values = arena.allocate<uint32_t>(capacity);
+    uint8_t *orientations = arena.allocate<uint8_t>(quadCount);
+    /* The table of a depth 4 sponge takes over 100 MB, it is cleared a slice at a time so that a cancellation isn't
+     * held up by the system zeroing its pages */
+    const uint64_t sliceSize = 16 * CancellationToken::CHECK_INTERVAL;
+    for (uint64_t slot = 0; slot < capacity; slot += sliceSize) {
+        if (cancellation.isCancelled()) return;
+        fill(keys + slot, keys + min(capacity, slot + sliceSize), UINT64_MAX);
+    }
 
-    /* Extract the child parallelepiped */
-    vector<float> childParallelepiped;
-    for (uint8_t index : childIndices) {
-        addPointToVector(childParallelepiped, parentVertices, index);
+    /* Faces are aligned with the lattice, the cross product of two sides gives the axis and side they face */
+    for (uint64_t quad = 0; quad < quadCount; ++quad) {
+        if (quad % CancellationToken::CHECK_INTERVAL == 0 && cancellation.isCancelled()) return;
+        orientations[quad] = (uint8_t) getLatticeQuadOrientation(vertices.data(), &indices[6 * quad]);
     }
 
-    /* Check if the apparent faces aren't hidden because of the a neighbor of the parent cube */
-    vector<Faces> childApparentFaces;
-    for (Faces face : childPossiblyApparentFaces) {
-        if (contains(parentApparentFaces, face)) {
-            childApparentFaces.push_back(face);
+    weldedVertices.clear();
+    weldedVertices.reserve(quadCount * 4 * 4);
+    weldedIndices.resize(indices.size());
+    batches.clear();
+    IndexBatch batch = {0, 0, 0};
+    uint64_t weldedIndex = 0;
+    /* One pass per orientation, the quads of the others being skipped */
+    for (uint8_t orientation = 0; orientation < 6; ++orientation) {
+        for (uint64_t quad = 0; quad < quadCount; ++quad) {
+            if (quad % CancellationToken::CHECK_INTERVAL == 0 && cancellation.isCancelled()) return;
+            if (orientations[quad] != orientation) continue;
+
+            /* The batch is closed when the quad may not fit, its vertices are left behind in the table */
+            uint32_t vertexCount = weldedVertices.size() / 4;
+            if (vertexCount - batch.firstVertex + 4 > IndexBatch::MAX_VERTICES) {
+                batches.push_back(batch);
+                batch = {vertexCount, (uint32_t) weldedIndex, 0};
+            }
+            for (uint8_t i = 0; i < 6; ++i) {
+                const uint16_t *point = &vertices[3 * indices[6 * quad + i]];
+                uint64_t key = orientation | (uint64_t) point[0] << 3u | (uint64_t) point[1] << 18u |
+                               (uint64_t) point[2] << 33u;
+                uint64_t slot = (key * 0x9E3779B97F4A7C15ull) >> (64u - capacityBits);
+                while (keys[slot] != key && keys[slot] != UINT64_MAX) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                /* A vertex of a previous batch can't be referenced, the point gets a new one */
+                if (keys[slot] == UINT64_MAX || values[slot] < batch.firstVertex) {
+                    keys[slot] = key;
+                    values[slot] = weldedVertices.size() / 4;
+                    weldedVertices.insert(weldedVertices.end(), {point[0], point[1], point[2], orientation});
+                }
+                weldedIndices[weldedIndex++] = (uint16_t) (values[slot] - batch.firstVertex);
+            }
+            batch.indexCount += 6;
         }
     }
-
-    /* Indicate which faces will be worth drawing */
-    childApparentFaces.insert(childApparentFaces.end(), childMandatoryFaces.begin(), childMandatoryFaces.end());
-
-    /* Subdivide the child parallelepiped */
-    recursiveSubdivide(depth - 1, childParallelepiped, vertices, indices, childApparentFaces);
+    if (batch.indexCount > 0) {
+        batches.push_back(batch);
+    }
 }
 
-void Sponge::recursiveSubdivide(uint8_t depth, const vector<float> &parallelepiped, vector<float> &vertices,
-                                vector<uint32_t> &indices, const vector<Faces> &parentApparentFaces) {
-    if (killComputation) throw WorkerKilled();
-
-    if (depth > 0) {
-        /* Subdivide the given parallelepiped into 27 smaller one */
-        vector<float> subdivisionResult;
-        subdivideParallelepiped(parallelepiped, subdivisionResult);
-
-        /* Speaking inside the parent parallelepiped, X=0, Y=0, Z=2 (front face, bottom row, last column) */
-        {
-            vector<uint8_t> childIndices = {0, 1, 4, 5, 16, 17, 20, 21};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Left, Bottom};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+void Sponge::optimizeVertexCache(const vector<uint16_t> &vertices, vector<uint16_t> &indices, const IndexBatch &batch,
+                                 Arena &arena, const CancellationToken &cancellation) {
+    const uint32_t cacheSize = VERTEX_CACHE_SIZE;
+    const uint16_t *batchVertices = &vertices[4 * batch.firstVertex];
+    const uint32_t batchEnd = batch.firstIndex + batch.indexCount;
+    uint32_t runEnd;
+    for (uint32_t runStart = batch.firstIndex; runStart < batchEnd; runStart = runEnd) {
+        if (cancellation.isCancelled()) return;
+
+        /* The quads of an orientation are consecutive, and so are their vertices */
+        const uint16_t orientation = batchVertices[4 * indices[runStart] + 3];
+        uint16_t firstVertex = UINT16_MAX, lastVertex = 0;
+        for (runEnd = runStart; runEnd < batchEnd && batchVertices[4 * indices[runEnd] + 3] == orientation;
+             runEnd += 6) {
+            for (uint8_t i = 0; i < 6; ++i) {
+                firstVertex = min(firstVertex, indices[runEnd + i]);
+                lastVertex = max(lastVertex, indices[runEnd + i]);
+            }
         }
-
-        /* X=1, Y=0, Z=2 */
-        {
-            vector<uint8_t> childIndices = {1, 2, 5, 6, 17, 18, 21, 22};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Bottom};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-             * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Top, Front};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        const uint16_t *runIndices = &indices[runStart];
+        const uint32_t triangleCount = (runEnd - runStart) / 3;
+        const uint32_t vertexCount = lastVertex - firstVertex + 1u;
+
+        /* Triangles of each vertex, as offsets into a single array */
+        Arena::Mark mark = arena.mark();
+        uint32_t *offsets = arena.allocate<uint32_t>(vertexCount + 1);
+        uint32_t *liveTriangles = arena.allocate<uint32_t>(vertexCount);
+        uint32_t *adjacency = arena.allocate<uint32_t>(3 * triangleCount);
+        fill(liveTriangles, liveTriangles + vertexCount, 0);
+        for (uint32_t index = 0; index < 3 * triangleCount; ++index) {
+            ++liveTriangles[runIndices[index] - firstVertex];
         }
-
-        /* X=2, Y=0, Z=2 */
-        {
-            vector<uint8_t> childIndices = {2, 3, 6, 7, 18, 19, 22, 23};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Bottom, Right};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        offsets[0] = 0;
+        for (uint32_t vertex = 0; vertex < vertexCount; ++vertex) {
+            offsets[vertex + 1] = offsets[vertex] + liveTriangles[vertex];
         }
-
-        /* X=2, Y=0, Z=1 */
-        {
-            vector<uint8_t> childIndices = {18, 19, 22, 23, 34, 35, 38, 39};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Bottom, Right};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Top, Left};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        for (uint32_t index = 0; index < 3 * triangleCount; ++index) {
+            const uint32_t vertex = runIndices[index] - firstVertex;
+            adjacency[offsets[vertex + 1] - liveTriangles[vertex]--] = index / 3;
         }
-
-        /* X=0, Y=0, Z=1 */
-        {
-            vector<uint8_t> childIndices = {16, 17, 20, 21, 32, 33, 36, 37};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Left, Bottom};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-             * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Top, Right};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        for (uint32_t vertex = 0; vertex < vertexCount; ++vertex) {
+            liveTriangles[vertex] = offsets[vertex + 1] - offsets[vertex];
         }
 
-        /* X=0, Y=0, Z=0 */
-        {
-            vector<uint8_t> childIndices = {32, 33, 36, 37, 48, 49, 52, 53};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Left, Bottom, Front};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        /* A vertex is in the cache while fewer than cacheSize vertices entered it since it did */
+        uint32_t *cacheTimes = arena.allocate<uint32_t>(vertexCount);
+        fill(cacheTimes, cacheTimes + vertexCount, 0);
+        uint32_t time = cacheSize + 1;
+        bool *emitted = arena.allocate<bool>(triangleCount);
+        fill(emitted, emitted + triangleCount, false);
+        uint32_t *deadEnds = arena.allocate<uint32_t>(3 * triangleCount);
+        uint32_t deadEndCount = 0;
+        uint32_t *candidates = arena.allocate<uint32_t>(3 * triangleCount);
+        uint16_t *reordered = arena.allocate<uint16_t>(3 * triangleCount);
+        uint32_t reorderedCount = 0;
+
+        uint32_t fanning = 0, nextInOrder = 1;
+        while (fanning != UINT32_MAX) {
+            /* Emit every triangle left around the fanning vertex, their vertices are candidates to fan next */
+            uint32_t candidateCount = 0;
+            for (uint32_t adjacent = offsets[fanning]; adjacent < offsets[fanning + 1]; ++adjacent) {
+                const uint32_t triangle = adjacency[adjacent];
+                if (emitted[triangle]) continue;
+                emitted[triangle] = true;
+                for (uint8_t corner = 0; corner < 3; ++corner) {
+                    const uint32_t vertex = runIndices[3 * triangle + corner] - firstVertex;
+                    reordered[reorderedCount++] = runIndices[3 * triangle + corner];
+                    deadEnds[deadEndCount++] = vertex;
+                    candidates[candidateCount++] = vertex;
+                    --liveTriangles[vertex];
+                    if (time - cacheTimes[vertex] > cacheSize) {
+                        cacheTimes[vertex] = time++;
+                    }
+                }
+            }
+
+            /* The best candidate is the oldest in the cache that will still be in it once its triangles are
+             * emitted, each of them adding up to 2 vertices */
+            uint32_t next = UINT32_MAX;
+            int64_t bestPriority = -1;
+            for (uint32_t candidate = 0; candidate < candidateCount; ++candidate) {
+                const uint32_t vertex = candidates[candidate];
+                if (liveTriangles[vertex] == 0) continue;
+                int64_t priority = 0;
+                if (time - cacheTimes[vertex] + 2 * liveTriangles[vertex] <= cacheSize) {
+                    priority = time - cacheTimes[vertex];
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    next = vertex;
+                }
+            }
+
+            /* At a dead end, fan around the last vertex still having triangles, or the next one in order */
+            while (next == UINT32_MAX && deadEndCount > 0) {
+                const uint32_t vertex = deadEnds[--deadEndCount];
+                if (liveTriangles[vertex] > 0) {
+                    next = vertex;
+                }
+            }
+            while (next == UINT32_MAX && nextInOrder < vertexCount) {
+                if (liveTriangles[nextInOrder] > 0) {
+                    next = nextInOrder;
+                }
+                ++nextInOrder;
+            }
+            fanning = next;
         }
+        copy(reordered, reordered + reorderedCount, indices.begin() + runStart);
+        arena.release(mark);
+    }
+}
 
-        /* X=1, Y=0, Z=0 */
-        {
-            vector<uint8_t> childIndices = {33, 34, 37, 38, 49, 50, 53, 54};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Bottom, Front};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Top, Back};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+double Sponge::getAverageCacheMissRatio(const vector<uint16_t> &indices, const vector<IndexBatch> &batches,
+                                        uint32_t cacheSize) {
+    uint64_t misses = 0;
+    vector<uint32_t> entryTimes(IndexBatch::MAX_VERTICES);
+    for (const IndexBatch &batch : batches) {
+        /* A vertex is in the cache while fewer than cacheSize misses happened since its own */
+        uint32_t batchMisses = 0;
+        fill(entryTimes.begin(), entryTimes.end(), 0);
+        for (uint32_t index = batch.firstIndex; index < batch.firstIndex + batch.indexCount; ++index) {
+            uint32_t &entryTime = entryTimes[indices[index]];
+            if (entryTime == 0 || batchMisses - entryTime >= cacheSize) {
+                entryTime = ++batchMisses;
+            }
         }
+        misses += batchMisses;
+    }
+    return indices.empty() ? 0.0 : (double) misses / (indices.size() / 3);
+}
 
-        /* X=2, Y=0, Z=0 */
-        {
-            vector<uint8_t> childIndices = {34, 35, 38, 39, 50, 51, 54, 55};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Bottom, Front, Right};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+void Sponge::buildMeshlets(const vector<uint16_t> &vertices, const vector<uint16_t> &indices,
+                           const vector<IndexBatch> &batches, vector<Meshlet> &meshlets) {
+    meshlets.clear();
+    for (uint32_t batch = 0; batch < batches.size(); ++batch) {
+        const uint16_t *batchVertices = &vertices[4 * batches[batch].firstVertex];
+        const uint32_t batchEnd = batches[batch].firstIndex + batches[batch].indexCount;
+        Meshlet meshlet = {};
+        for (uint32_t quad = batches[batch].firstIndex; quad < batchEnd; quad += 6) {
+            /* Every corner of the 2 triangles has the orientation of their faces */
+            uint16_t orientation = batchVertices[4 * indices[quad] + 3];
+            if (meshlet.indexCount > 0 &&
+                (orientation != meshlet.orientation || meshlet.indexCount + 6 > 3 * Meshlet::MAX_TRIANGLES)) {
+                meshlets.push_back(meshlet);
+                meshlet.indexCount = 0;
+            }
+            if (meshlet.indexCount == 0) {
+                fill(meshlet.lowest, meshlet.lowest + 3, UINT16_MAX);
+                fill(meshlet.highest, meshlet.highest + 3, 0);
+                meshlet.orientation = orientation;
+                meshlet.batch = batch;
+                meshlet.firstIndex = quad;
+            }
+            for (uint8_t i = 0; i < 6; ++i) {
+                const uint16_t *point = &batchVertices[4 * indices[quad + i]];
+                for (uint8_t axis = 0; axis < 3; ++axis) {
+                    meshlet.lowest[axis] = min(meshlet.lowest[axis], point[axis]);
+                    meshlet.highest[axis] = max(meshlet.highest[axis], point[axis]);
+                }
+            }
+            meshlet.indexCount += 6;
         }
-
-        /* X=2, Y=1, Z=0 */
-        {
-            vector<uint8_t> childIndices = {38, 39, 42, 43, 54, 55, 58, 59};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Front, Right};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Back, Left};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        if (meshlet.indexCount > 0) {
+            meshlets.push_back(meshlet);
         }
+    }
+}
 
-        /* X=0, Y=1, Z=0 */
-        {
-            vector<uint8_t> childIndices = {36, 37, 40, 41, 52, 53, 56, 57};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Front, Left};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-             * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Back, Right};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+void Sponge::mergeCoplanarFaces(vector<uint16_t> &vertices, vector<uint32_t> &indices, uint16_t latticeSize,
+                                Arena &arena, const CancellationToken &cancellation) {
+    /* A plane is given by the orientation of its faces and its coordinate along their axis, the faces of a plane
+     * are rectangles given by their lowest and highest coordinates along the two other axes, taken in cyclic order */
+    uint64_t quadCount = indices.size() / 6;
+    uint32_t planeCount = 6u * (latticeSize + 1u);
+    arena.reset();
+    uint32_t *planes = arena.allocate<uint32_t>(quadCount);
+    uint16_t (*rectangles)[4] = arena.allocate<uint16_t[4]>(quadCount);
+    uint32_t *planeStarts = arena.allocate<uint32_t>(planeCount + 1);
+    uint32_t *sortedQuads = arena.allocate<uint32_t>(quadCount);
+    uint8_t *grid = arena.allocate<uint8_t>((uint64_t) latticeSize * latticeSize);
+    fill(planeStarts, planeStarts + planeCount + 1, 0);
+    fill(grid, grid + (uint64_t) latticeSize * latticeSize, 0);
+
+    for (uint64_t quad = 0; quad < quadCount; ++quad) {
+        if (quad % CancellationToken::CHECK_INTERVAL == 0 && cancellation.isCancelled()) return;
+
+        /* Both triangles cover the quad, so the corners of the quad are the bounds of its 6 references */
+        uint16_t lowest[3] = {UINT16_MAX, UINT16_MAX, UINT16_MAX}, highest[3] = {0, 0, 0};
+        for (uint8_t i = 0; i < 6; ++i) {
+            const uint16_t *point = &vertices[3 * indices[6 * quad + i]];
+            for (uint8_t axis = 0; axis < 3; ++axis) {
+                lowest[axis] = min(lowest[axis], point[axis]);
+                highest[axis] = max(highest[axis], point[axis]);
+            }
         }
+        uint16_t orientation = getLatticeQuadOrientation(vertices.data(), &indices[6 * quad]);
+        uint8_t axis = orientation / 2u, uAxis = (axis + 1u) % 3u, vAxis = (axis + 2u) % 3u;
+        planes[quad] = orientation * (latticeSize + 1u) + lowest[axis];
+        rectangles[quad][0] = lowest[uAxis];
+        rectangles[quad][1] = lowest[vAxis];
+        rectangles[quad][2] = highest[uAxis];
+        rectangles[quad][3] = highest[vAxis];
+        ++planeStarts[planes[quad] + 1];
+    }
 
-        /* X=0, Y=1, Z=2 */
-        {
-            vector<uint8_t> childIndices = {4, 5, 8, 9, 20, 21, 24, 25};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Left};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Front, Right};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+    /* Sort the quads by plane with a counting sort */
+    for (uint32_t plane = 0; plane < planeCount; ++plane) {
+        planeStarts[plane + 1] += planeStarts[plane];
+    }
+    for (uint64_t quad = 0; quad < quadCount; ++quad) {
+        sortedQuads[planeStarts[planes[quad]]++] = quad;
+    }
+    for (uint32_t plane = planeCount; plane > 0; --plane) {
+        planeStarts[plane] = planeStarts[plane - 1];
+    }
+    planeStarts[0] = 0;
+
+    /* The quads were read, their vectors now receive the merged ones, which are fewer. Each one has its own 4
+     * corners, which may be more vertices than the quads had: the room is made while the vector is empty, so that it
+     * is never copied to a larger one */
+    vertices.clear();
+    vertices.reserve(quadCount * 4 * 3);
+    indices.clear();
+    for (uint32_t plane = 0; plane < planeCount; ++plane) {
+        /* A plane never spans more than a face of the cell, the token is read once per plane */
+        if (cancellation.isCancelled()) return;
+        if (planeStarts[plane] == planeStarts[plane + 1]) continue;
+
+        /* Mark every lattice square covered by the plane's quads */
+        uint16_t lowest[2] = {UINT16_MAX, UINT16_MAX}, highest[2] = {0, 0};
+        for (uint32_t position = planeStarts[plane]; position < planeStarts[plane + 1]; ++position) {
+            const uint16_t *rectangle = rectangles[sortedQuads[position]];
+            for (uint16_t v = rectangle[1]; v < rectangle[3]; ++v) {
+                fill(grid + (uint64_t) v * latticeSize + rectangle[0], grid + (uint64_t) v * latticeSize + rectangle[2],
+                     1);
+            }
+            lowest[0] = min(lowest[0], rectangle[0]);
+            lowest[1] = min(lowest[1], rectangle[1]);
+            highest[0] = max(highest[0], rectangle[2]);
+            highest[1] = max(highest[1], rectangle[3]);
         }
 
-        /* X=2, Y=1, Z=2 */
-        {
-            vector<uint8_t> childIndices = {6, 7, 10, 11, 22, 23, 26, 27};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Right};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Front, Left};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+        /* Greedy meshing: the first marked square found grows as wide as it can along u, then as high as it can
+         * along v while every square of its width is marked. Its squares are unmarked, leaving the grid clear once
+         * the plane is done */
+        uint16_t orientation = plane / (latticeSize + 1u), coordinate = plane % (latticeSize + 1u);
+        uint8_t axis = orientation / 2u, uAxis = (axis + 1u) % 3u, vAxis = (axis + 2u) % 3u;
+        for (uint16_t v = lowest[1]; v < highest[1]; ++v) {
+            uint8_t *row = grid + (uint64_t) v * latticeSize;
+            for (uint16_t u = lowest[0]; u < highest[0]; ++u) {
+                if (!row[u]) continue;
+
+                uint16_t width = 1, height = 1;
+                while (u + width < highest[0] && row[u + width]) {
+                    ++width;
+                }
+                while (v + height < highest[1] &&
+                       all_of(row + height * latticeSize + u, row + height * latticeSize + u + width,
+                              [](uint8_t marked) { return marked != 0; })) {
+                    ++height;
+                }
+                for (uint16_t line = 0; line < height; ++line) {
+                    fill(row + line * latticeSize + u, row + line * latticeSize + u + width, 0);
+                }
+
+                /* Corners in the (a, b, c), (b, d, c) pattern of the leaves, b and c being swapped for faces
+                 * looking at the negative side so that (b - a) x (c - a) keeps its orientation */
+                uint32_t first = vertices.size() / 3;
+                for (uint8_t corner = 0; corner < 4; ++corner) {
+                    bool alongU = (orientation & 1u) ? corner & 2u : corner & 1u;
+                    bool alongV = (orientation & 1u) ? corner & 1u : corner & 2u;
+                    uint16_t point[3];
+                    point[axis] = coordinate;
+                    point[uAxis] = u + (alongU ? width : 0);
+                    point[vAxis] = v + (alongV ? height : 0);
+                    vertices.insert(vertices.end(), point, point + 3);
+                }
+                indices.insert(indices.end(), {first, first + 1, first + 2, first + 1, first + 3, first + 2});
+            }
         }
+    }
+}
 
-        /* X=2, Y=2, Z=2 */
-        {
-            vector<uint8_t> childIndices = {10, 11, 14, 15, 26, 27, 30, 31};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Right, Top};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+void Sponge::splitLatticeCube(const LatticeCube &cube, LatticeCube *children) const {
+    uint16_t third = cube.size / 3;
+    for (const ChildDescription &child : childrenDescriptions) {
+        *children++ = {{(uint16_t) (cube.origin[0] + child.corners[0] % 4 * third),
+                        (uint16_t) (cube.origin[1] + child.corners[0] / 4 % 4 * third),
+                        (uint16_t) (cube.origin[2] + child.corners[0] / 16 * third)},
+                       third, (uint8_t) (cube.depth - 1), getChildApparentFaces(child, cube.apparentFaces)};
+    }
+}
 
-        /* X=1, Y=2, Z=2 */
-        {
-            vector<uint8_t> childIndices = {9, 10, 13, 14, 25, 26, 29, 30};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Top};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Front, Bottom};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+void Sponge::addFaces(uint64_t shift, uint32_t *indices, FacesMask apparentFaces) const {
+    /* Write the list of vertices needed to describe the apparent faces and the tube made apparent by the holes of the
+     * sponge (a shift needs to be applied to compensate for the vertices that precede this batch) */
+    const vector<uint8_t> &faceIndices = apparentFacesIndices[apparentFaces];
+    for (uint64_t i = 0; i < faceIndices.size(); ++i) {
+        indices[i] = faceIndices[i] + shift;
+    }
+}
 
-        /* X=0, Y=2, Z=2 */
-        {
-            vector<uint8_t> childIndices = {8, 9, 12, 13, 24, 25, 28, 29};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Back, Left, Top};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+void Sponge::subdivideParallelepiped(const float *parallelepiped, float *result) {
+    /* The 64 points are weighted sums of the 8 corners, evaluated at once with the widest instructions available */
+    LatticeKernel::evaluate(parallelepiped, result, result + 64, result + 128);
+}
 
-        /* X=0, Y=2, Z=1 */
-        {
-            vector<uint8_t> childIndices = {24, 25, 28, 29, 40, 41, 44, 45};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Left, Top};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Bottom, Right};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+void Sponge::subdivideChild(uint8_t depth, const float *parentVertices, const ChildDescription &child,
+                            FacesMask childApparentFaces, PointArrays &vertices, uint32_t *indices,
+                            uint64_t firstVertex, Arena &arena) const {
+    /* Extract the child parallelepiped, the parent gives each coordinate of its vertices in its own array */
+    float childParallelepiped[24];
+    for (uint8_t corner = 0; corner < 8; ++corner) {
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            childParallelepiped[3 * corner + axis] = parentVertices[64 * axis + child.corners[corner]];
         }
+    }
 
-        /* X=2, Y=2, Z=1 */
-        {
-            vector<uint8_t> childIndices = {26, 27, 30, 31, 42, 43, 46, 47};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Right, Top};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-             * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Bottom, Left};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+    /* Subdivide the child parallelepiped */
+    recursiveSubdivide(depth - 1, childParallelepiped, childApparentFaces, vertices, indices, firstVertex, arena);
+}
 
-        /* X=2, Y=2, Z=0 */
-        {
-            vector<uint8_t> childIndices = {42, 43, 46, 47, 58, 59, 62, 63};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-            * faces */
-            vector<Faces> childPossiblyApparentFaces = {Right, Top, Front};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+void Sponge::recursiveSubdivide(uint8_t depth, const float *parallelepiped, FacesMask parentApparentFaces,
+                                PointArrays &vertices, uint32_t *indices, uint64_t firstVertex,
+                                Arena &arena) const {
+    if (depth > 0) {
+        /* Subdivide the given parallelepiped into 27 smaller one, the subdivision lives in the arena until every
+         * child was handled */
+        Arena::Mark frame = arena.mark();
+        float *subdivisionResult = arena.allocate<float>(192);
+        subdivideParallelepiped(parallelepiped, subdivisionResult);
 
-        /* X=1, Y=2, Z=0 */
-        {
-            vector<uint8_t> childIndices = {41, 42, 45, 46, 57, 58, 61, 62};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Front, Top};
-            /* Create the set of faces that will definitely be apparent from the exterior (those are made apparent
-            * through the hole of the sponge) */
-            vector<Faces> childMandatoryFaces = {Bottom, Back};
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
-        }
+        /* Only 20 of the 27 smaller parallelepipeds are kept, the others are the holes of the sponge.
+         * Each child is written right after the previous one, the size of its subtree being known in advance */
+        for (const ChildDescription &child : childrenDescriptions) {
+            FacesMask childApparentFaces = getChildApparentFaces(child, parentApparentFaces);
+            subdivideChild(depth, subdivisionResult, child, childApparentFaces, vertices, indices, firstVertex,
+                           arena);
 
-        /* X=1, Y=2, Z=0 */
-        {
-            vector<uint8_t> childIndices = {40, 41, 44, 45, 56, 57, 60, 61};
-            /* Create the set of faces that could be apparent from the exterior, however neighbor cube might hide those
-             * faces */
-            vector<Faces> childPossiblyApparentFaces = {Left, Top, Front};
-            vector<Faces> childMandatoryFaces;
-            subdivideChild(depth, vertices, indices, subdivisionResult, childIndices, parentApparentFaces,
-                           childPossiblyApparentFaces, childMandatoryFaces);
+            const MeshSize &childSize = subtreeSizes[depth - 1][childApparentFaces];
+            indices += childSize.indices;
+            firstVertex += childSize.vertices;
         }
-
+        arena.release(frame);
     } else {
-        /* Max depth is achieved, the given parallelepiped is subdivided and the subdivision is added to the vertices
-         * list */
-        subdivideParallelepiped(parallelepiped, vertices);
-        /* Indices are added in order to draw the faces described by the newly created vertices */
-        addFaces((vertices.size() - 192) / 3, indices, parentApparentFaces);
+        /* Max depth is achieved, the given parallelepiped is subdivided and the subdivision is written at its place
+         * in the vertices list */
+        LatticeKernel::evaluate(parallelepiped, vertices.getCoordinates(0) + firstVertex,
+                                vertices.getCoordinates(1) + firstVertex, vertices.getCoordinates(2) + firstVertex);
+        /* Indices are written in order to draw the faces described by the newly created vertices */
+        addFaces(firstVertex, indices, parentApparentFaces);
     }
 }
 
-
+void Sponge::recursiveSubdivideLattice(uint8_t depth, const uint16_t *origin, uint16_t size,
+                                       FacesMask parentApparentFaces, uint16_t *vertices, uint32_t *indices,
+                                       uint64_t firstVertex) const {
+    uint16_t third = size / 3;
+    if (depth > 0) {
+        /* Same children in the same order as recursiveSubdivide, each one starting at the lattice point of its first
+         * corner */
+        for (const ChildDescription &child : childrenDescriptions) {
+            FacesMask childApparentFaces = getChildApparentFaces(child, parentApparentFaces);
+            const uint16_t childOrigin[3] = {(uint16_t) (origin[0] + child.corners[0] % 4 * third),
+                                             (uint16_t) (origin[1] + child.corners[0] / 4 % 4 * third),
+                                             (uint16_t) (origin[2] + child.corners[0] / 16 * third)};
+            recursiveSubdivideLattice(depth - 1, childOrigin, third, childApparentFaces, vertices, indices,
+                                      firstVertex);
+
+            const MeshSize &childSize = subtreeSizes[depth - 1][childApparentFaces];
+            vertices += childSize.vertices * 3;
+            indices += childSize.indices;
+            firstVertex += childSize.vertices;
+        }
+    } else {
+        /* The 64 lattice points of the leaf, in the order of subdivideParallelepiped */
+        for (uint8_t k = 0; k < 4; ++k) {
+            for (uint8_t j = 0; j < 4; ++j) {
+                for (uint8_t i = 0; i < 4; ++i) {
+                    *vertices++ = origin[0] + i * third;
+                    *vertices++ = origin[1] + j * third;
+                    *vertices++ = origin[2] + k * third;
+                }
+            }
+        }
+        addFaces(firstVertex, indices, parentApparentFaces);
+    }
+}
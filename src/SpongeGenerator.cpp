@@ -0,0 +1,423 @@
+#include "../headers/SpongeGenerator.h"
+
+using namespace std;
+
+/**
+ * Grow a vector to the given size a slice at a time, so that a cancellation isn't held up while the system zeroes the
+ * pages of a large mesh (over 100 ms for the 185 MB of a depth 4 cell sponge)
+ * @param values is the vector to resize
+ * @param size is its new size
+ * @param cancellation stops the growth when raised, leaving the vector smaller
+ * @return false if it was cancelled
+ */
+template<typename T>
+static bool resizeCancellably(vector<T> &values, uint64_t size, const CancellationToken &cancellation) {
+    const uint64_t sliceSize = 1u << 20u;
+    values.reserve(size);
+    while (values.size() + sliceSize < size) {
+        if (cancellation.isCancelled()) return false;
+        values.resize(values.size() + sliceSize);
+    }
+    values.resize(size);
+    return true;
+}
+
+SpongeGenerator::SpongeGenerator(uint32_t threadCount)
+        : threadCount(max(1u, threadCount != 0 ? threadCount : thread::hardware_concurrency())),
+          arenas(this->threadCount), workerChunks(this->threadCount), workerLattices(this->threadCount),
+          workerLatticeIndices(this->threadCount) {
+    for (uint32_t worker = 1; worker < this->threadCount; ++worker) {
+        helpers.emplace_back(&SpongeGenerator::runHelper, this, worker);
+    }
+}
+
+SpongeGenerator::~SpongeGenerator() {
+    {
+        lock_guard<mutex> lock(batchesMutex);
+        stopping = true;
+    }
+    batchesChanged.notify_all();
+    for (thread &helper : helpers) {
+        helper.join();
+    }
+}
+
+void SpongeGenerator::generate(uint8_t depth, const vector<float> *parallelepipeds, uint8_t count,
+                               PointArrays *vertices, vector<uint32_t> *indices, PointArrays *normals) {
+    subdivideCells(depth, parallelepipeds, count, vertices, indices);
+
+    /* Duplicate vertices used by many "sides" to allow calculation of independent vertices normals, then compute
+     * said normals, one cell per worker */
+    runConcurrently(count, [&](uint32_t cell, uint32_t worker) {
+        Sponge::duplicateVertices(vertices[cell], indices[cell], arenas[worker]);
+        Sponge::computeSpongeNormals(vertices[cell], indices[cell], normals[cell]);
+    });
+}
+
+void SpongeGenerator::subdivideCells(uint8_t depth, const vector<float> *parallelepipeds, uint8_t count,
+                                     PointArrays *vertices, vector<uint32_t> *indices) {
+    /* Size each cell mesh once, keeping room for the duplicated vertices */
+    planTasks(depth, count);
+    MeshSize size = sponge.predictMeshSize(depth);
+    for (uint8_t cell = 0; cell < count; ++cell) {
+        vertices[cell].reserve(size.vertices + size.duplicates);
+        vertices[cell].resize(size.vertices);
+        indices[cell].resize(size.indices);
+    }
+
+    /* Subdivide every subtree directly at its place in its cell */
+    runConcurrently(tasks.size(), [&](uint32_t job, uint32_t worker) {
+        const Task &task = tasks[job];
+        if (depth > 0) {
+            sponge.subdivideSubtree(depth, parallelepipeds[task.cell], task.child, vertices[task.cell],
+                                    indices[task.cell].data() + task.firstIndex, task.firstVertex, arenas[worker]);
+        } else {
+            sponge.subdivide(depth, parallelepipeds[task.cell], vertices[task.cell], indices[task.cell],
+                             arenas[worker]);
+        }
+    });
+}
+
+void SpongeGenerator::planTasks(uint8_t depth, uint8_t count) {
+    /* Split each cell into the subtrees of its first subdivision (a cell of depth 0 can't be split) */
+    uint8_t subtrees = depth > 0 ? Sponge::CHILDREN_COUNT : 1;
+    tasks.resize(count * subtrees);
+
+    /* Give every subtree its slice of the cell mesh using prefix sums of the predicted subtrees sizes */
+    for (uint8_t cell = 0; cell < count; ++cell) {
+        uint64_t vertexCount = 0, indexCount = 0;
+        for (uint8_t child = 0; child < subtrees; ++child) {
+            Task &task = tasks[cell * subtrees + child];
+            task.cell = cell;
+            task.child = child;
+            task.firstVertex = vertexCount;
+            task.firstIndex = indexCount;
+            if (depth > 0) {
+                MeshSize subtreeSize = sponge.predictSubtreeSize(depth, child);
+                vertexCount += subtreeSize.vertices;
+                indexCount += subtreeSize.indices;
+            }
+        }
+    }
+}
+
+MeshSize SpongeGenerator::planLeafRanges() {
+    /* A few ranges per worker, so that they all end at about the same time */
+    uint64_t rangeCount = min<uint64_t>(leaves.size(), threadCount * 8u);
+    leafRanges.resize(rangeCount);
+
+    /* Give every range its slice of the cell mesh using prefix sums of the predicted leaves sizes */
+    MeshSize size = {0, 0, 0};
+    uint64_t leaf = 0;
+    for (uint64_t range = 0; range < rangeCount; ++range) {
+        LeafRange &leafRange = leafRanges[range];
+        leafRange.firstLeaf = leaf;
+        leafRange.leafCount = leaves.size() * (range + 1) / rangeCount - leaf;
+        leafRange.firstVertex = size.vertices;
+        leafRange.firstIndex = size.indices;
+        for (; leaf < leafRange.firstLeaf + leafRange.leafCount; ++leaf) {
+            MeshSize leafSize = sponge.predictMeshSize(0, leaves[leaf].apparentFaces);
+            size.vertices += leafSize.vertices;
+            size.indices += leafSize.indices;
+        }
+    }
+    return size;
+}
+
+bool SpongeGenerator::generateCellSponge(uint8_t depth, CellSponge &cellSponge, const CancellationToken &cancellation) {
+    /* Depth d + 1 is every leaf of depth d subdivided once more, the leaves of the previous call are refined when
+     * they are one level short. Otherwise they are found from the unit cube */
+    if (!leaves.empty() && leavesDepth + 1 == depth) {
+        sponge.refineLattice(leaves, refinedLeaves);
+        leaves.swap(refinedLeaves);
+    } else if (leaves.empty() || leavesDepth != depth) {
+        sponge.splitLattice(depth, depth, leaves);
+    }
+    leavesDepth = depth;
+
+    /* Write the leaves on the integer lattice, consecutive leaves being shared between workers */
+    MeshSize size = planLeafRanges();
+    /* Vectors left short by a cancellation are never written nor read, every next step checks the token */
+    if (resizeCancellably(lattice, size.vertices * 3, cancellation) &&
+        resizeCancellably(latticeIndices, size.indices, cancellation)) {
+        runConcurrently(leafRanges.size(), [&](uint32_t job, uint32_t) {
+            if (cancellation.isCancelled()) return;
+            const LeafRange &leafRange = leafRanges[job];
+            sponge.subdivideLatticeLeaves(leaves.data() + leafRange.firstLeaf, leafRange.leafCount,
+                                          lattice.data() + leafRange.firstVertex * 3,
+                                          latticeIndices.data() + leafRange.firstIndex, leafRange.firstVertex,
+                                          cancellation);
+        });
+    }
+
+    /* Flat parts of the sponge are tiled by many quads, they are merged into larger rectangles. Leaves share their
+     * corners and edges with their neighbours, faces of the same orientation can share them too */
+    cellSponge.latticeSize = Sponge::getLatticeSize(depth);
+    if (!cancellation.isCancelled()) {
+        Sponge::mergeCoplanarFaces(lattice, latticeIndices, cellSponge.latticeSize, arenas[0], cancellation);
+    }
+    if (!cancellation.isCancelled()) {
+        Sponge::weldVertices(lattice, latticeIndices, cellSponge.vertices, cellSponge.indices, cellSponge.batches,
+                             arenas[0], cancellation);
+    }
+    /* Batches are reordered for the vertex cache independently of each other */
+    if (!cancellation.isCancelled()) {
+        runConcurrently(cellSponge.batches.size(), [&](uint32_t batch, uint32_t worker) {
+            Sponge::optimizeVertexCache(cellSponge.vertices, cellSponge.indices, cellSponge.batches[batch],
+                                        arenas[worker], cancellation);
+        });
+    }
+    if (!cancellation.isCancelled()) {
+        Sponge::buildMeshlets(cellSponge.vertices, cellSponge.indices, cellSponge.batches, cellSponge.meshlets);
+    }
+
+    /* The lattice before merging and the weld table are only needed while generating, they take hundreds of MB at
+     * depth 4 and are given back instead of being kept for the next depth */
+    vector<uint16_t>().swap(lattice);
+    vector<uint32_t>().swap(latticeIndices);
+    for (Arena &arena : arenas) {
+        arena.reset();
+        arena.trim();
+    }
+
+    /* A cancelled sponge is incomplete, it is emptied so that it is never mistaken for a sponge of the depth. The
+     * leaves are still those of the depth, they are kept */
+    if (cancellation.isCancelled()) {
+        cellSponge.depth = 0;
+        cellSponge.vertices.clear();
+        cellSponge.indices.clear();
+        cellSponge.batches.clear();
+        cellSponge.meshlets.clear();
+        return false;
+    }
+    cellSponge.depth = depth;
+    return true;
+}
+
+bool SpongeGenerator::generateChunks(uint8_t depth, ChunkStore &store, const CancellationToken &cancellation) {
+    vector<LatticeCube> cubes;
+    uint8_t level = depth > ChunkStore::CHUNK_DEPTH ? depth - ChunkStore::CHUNK_DEPTH : 0;
+    sponge.splitLattice(depth, level, cubes);
+
+    /* Merging never adds quads and welding leaves at most 4 vertices per quad, which bounds the size of the file.
+     * Every batch but the last one is nearly full, which bounds their number */
+    uint64_t capacity = 0;
+    for (const LatticeCube &cube : cubes) {
+        uint64_t indexCount = sponge.predictMeshSize(cube.depth, cube.apparentFaces).indices;
+        uint64_t batchCount = indexCount / 6 * 4 / (IndexBatch::MAX_VERTICES - 3) + 1;
+        capacity += indexCount * sizeof(uint16_t) + indexCount / 6 * 4 * 4 * sizeof(uint16_t) +
+                    batchCount * sizeof(IndexBatch);
+    }
+    store.open(depth, cubes, capacity);
+
+    /* A chunk is at most a subtree of ChunkStore::CHUNK_DEPTH, the token is read between the steps of each one and
+     * a cancelled chunk is never written */
+    uint16_t latticeSize = Sponge::getLatticeSize(depth);
+    runConcurrently(cubes.size(), [&](uint32_t chunk, uint32_t worker) {
+        if (cancellation.isCancelled()) return;
+        CellSponge &chunkSponge = workerChunks[worker];
+        vector<uint16_t> &chunkLattice = workerLattices[worker];
+        vector<uint32_t> &chunkIndices = workerLatticeIndices[worker];
+        sponge.subdivideLatticeCube(cubes[chunk], chunkLattice, chunkIndices);
+        Sponge::mergeCoplanarFaces(chunkLattice, chunkIndices, latticeSize, arenas[worker], cancellation);
+        if (cancellation.isCancelled()) return;
+        Sponge::weldVertices(chunkLattice, chunkIndices, chunkSponge.vertices, chunkSponge.indices,
+                             chunkSponge.batches, arenas[worker], cancellation);
+        if (cancellation.isCancelled()) return;
+        for (const IndexBatch &batch : chunkSponge.batches) {
+            Sponge::optimizeVertexCache(chunkSponge.vertices, chunkSponge.indices, batch, arenas[worker],
+                                        cancellation);
+        }
+        if (cancellation.isCancelled()) return;
+        store.write(chunk, chunkSponge.vertices, chunkSponge.indices, chunkSponge.batches);
+    });
+    return !cancellation.isCancelled();
+}
+
+void SpongeGenerator::project(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count,
+                              float cameraOffset4D, PointArrays *vertices, PointArrays *normals) {
+    projectCells(cellSponge, corners, count, cameraOffset4D, vertices, normals, CancellationToken(), false);
+}
+
+bool SpongeGenerator::projectInBackground(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count,
+                                          float cameraOffset4D, PointArrays *vertices, PointArrays *normals,
+                                          const CancellationToken &cancellation) {
+    return projectCells(cellSponge, corners, count, cameraOffset4D, vertices, normals, cancellation, true);
+}
+
+bool SpongeGenerator::projectCells(const CellSponge &cellSponge, const glm::vec4 *corners, uint8_t count,
+                                   float cameraOffset4D, PointArrays *vertices, PointArrays *normals,
+                                   const CancellationToken &cancellation, bool background) {
+    uint64_t vertexCount = cellSponge.vertices.size() / 4;
+    runConcurrently(count, [&](uint32_t cell, uint32_t) {
+        /* A cell is a few milliseconds of work at depth 3, the token is read before it */
+        if (cancellation.isCancelled()) return;
+        vertices[cell].resize(vertexCount);
+        if (normals != nullptr) {
+            normals[cell].resize(vertexCount);
+        }
+        projectCell(cellSponge.vertices.data(), cellSponge.latticeSize, vertexCount, corners + 8 * cell,
+                    cameraOffset4D, vertices[cell], normals == nullptr ? nullptr : &normals[cell]);
+    }, background);
+    return !cancellation.isCancelled();
+}
+
+uint32_t SpongeGenerator::getThreadCount() const {
+    return threadCount;
+}
+
+void SpongeGenerator::runConcurrently(uint32_t jobCount, const function<void(uint32_t, uint32_t)> &job,
+                                      bool background) {
+    Batch batch;
+    batch.job = &job;
+    batch.jobCount = jobCount;
+    batch.nextJob = 0;
+    batch.workerCount = 1;
+    batch.background = background;
+
+    /* The helpers are only woken up when there is work to share */
+    bool shared = !helpers.empty() && jobCount > 1;
+    if (shared) {
+        {
+            lock_guard<mutex> lock(batchesMutex);
+            batches.push_back(&batch);
+        }
+        batchesChanged.notify_all();
+    }
+    workOn(batch, 0);
+
+    /* Every job was taken, wait for the helpers still running one before the batch goes away */
+    if (shared) {
+        unique_lock<mutex> lock(batchesMutex);
+        --batch.workerCount;
+        batchesChanged.wait(lock, [&]() { return batch.workerCount == 0; });
+        batches.erase(find(batches.begin(), batches.end(), &batch));
+    }
+
+    if (batch.failure) {
+        rethrow_exception(batch.failure);
+    }
+}
+
+void SpongeGenerator::workOn(Batch &batch, uint32_t worker) {
+    try {
+        for (uint32_t current = batch.nextJob++; current < batch.jobCount; current = batch.nextJob++) {
+            (*batch.job)(current, worker);
+        }
+    } catch (...) {
+        lock_guard<mutex> lock(batchesMutex);
+        if (!batch.failure) {
+            batch.failure = current_exception();
+        }
+        /* Prevent the other workers from starting new jobs */
+        batch.nextJob = batch.jobCount;
+    }
+}
+
+void SpongeGenerator::runHelper(uint32_t worker) {
+    unique_lock<mutex> lock(batchesMutex);
+    while (true) {
+        /* Join the oldest batch that still has jobs to hand out, background batches only when no other one has */
+        Batch *batch = nullptr;
+        batchesChanged.wait(lock, [&]() {
+            batch = nullptr;
+            for (Batch *candidate : batches) {
+                if (candidate->nextJob >= candidate->jobCount) continue;
+                if (!candidate->background) {
+                    batch = candidate;
+                    return true;
+                }
+                if (batch == nullptr) {
+                    batch = candidate;
+                }
+            }
+            return batch != nullptr || stopping;
+        });
+        if (batch == nullptr) return;
+
+        ++batch->workerCount;
+        lock.unlock();
+        workOn(*batch, worker);
+        lock.lock();
+        if (--batch->workerCount == 0) {
+            batchesChanged.notify_all();
+        }
+    }
+}
+
+void SpongeGenerator::projectCell(const uint16_t *cellVertices, uint16_t latticeSize, uint64_t count,
+                                  const glm::vec4 *corners, float cameraOffset4D, PointArrays &vertices,
+                                  PointArrays *normals) {
+    /* Rotations were applied to the corners, so the edges of the cell hold the rotation of the unit cube axes. The
+     * edges are scaled down to a lattice step */
+    const glm::vec4 origin = corners[0];
+    const glm::vec4 edgeX = (corners[1] - corners[0]) / (float) latticeSize;
+    const glm::vec4 edgeY = (corners[2] - corners[0]) / (float) latticeSize;
+    const glm::vec4 edgeZ = (corners[4] - corners[0]) / (float) latticeSize;
+
+    /* The derivatives of the projection along 2 edges are edge.xyz + p * edge.w up to a positive factor, p being the
+     * projected point, the way the vertex shader computes them. Their cross product gives the normal of the faces
+     * across the third edge from the position of any of their vertices: cross(first, second) + cross(p, slope) with
+     * slope = first.w * second - second.w * first */
+    const glm::vec4 edges[3] = {edgeX, edgeY, edgeZ};
+    float *projectedX = vertices.getCoordinates(0), *projectedY = vertices.getCoordinates(1);
+    float *projectedZ = vertices.getCoordinates(2);
+    if (normals == nullptr) {
+        /* The faces are shaded flat from their screen space derivatives, only the positions are needed */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+        for (uint64_t vertex = 0; vertex < count; ++vertex) {
+            const float x = cellVertices[4 * vertex], y = cellVertices[4 * vertex + 1];
+            const float z = cellVertices[4 * vertex + 2];
+            const float w = origin.w + x * edgeX.w + y * edgeY.w + z * edgeZ.w;
+            const float scale = 1.0f / (cameraOffset4D - w);
+            projectedX[vertex] = (origin.x + x * edgeX.x + y * edgeY.x + z * edgeZ.x) * scale;
+            projectedY[vertex] = (origin.y + x * edgeX.y + y * edgeY.y + z * edgeZ.y) * scale;
+            projectedZ[vertex] = (origin.z + x * edgeX.z + y * edgeY.z + z * edgeZ.z) * scale;
+        }
+        return;
+    }
+    float *normalX = normals->getCoordinates(0), *normalY = normals->getCoordinates(1);
+    float *normalZ = normals->getCoordinates(2);
+    uint64_t groupStart = 0;
+    for (uint16_t orientation = 0; orientation < 6; ++orientation) {
+        /* The group of the orientation ends at the first vertex of a greater one */
+        uint64_t groupEnd = count;
+        for (uint64_t low = groupStart; low < groupEnd;) {
+            const uint64_t middle = low + (groupEnd - low) / 2;
+            if (cellVertices[4 * middle + 3] <= orientation) {
+                low = middle + 1;
+            } else {
+                groupEnd = middle;
+            }
+        }
+        const float side = orientation & 1u ? -1.0f : 1.0f;
+        const glm::vec4 &first = edges[(orientation / 2 + 1) % 3], &second = edges[(orientation / 2 + 2) % 3];
+        const glm::vec3 constant = side * glm::cross(glm::vec3(first), glm::vec3(second));
+        const glm::vec3 slope = side * (first.w * glm::vec3(second) - second.w * glm::vec3(first));
+
+        /* Branch free loop over the vertices so that the compiler can process several of them at once, each
+         * coordinate being stored contiguously. The 6 arrays never overlap, the compiler is told so rather than
+         * checking every pair of them, which it gives up on */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+        for (uint64_t vertex = groupStart; vertex < groupEnd; ++vertex) {
+            const float x = cellVertices[4 * vertex], y = cellVertices[4 * vertex + 1];
+            const float z = cellVertices[4 * vertex + 2];
+            const float w = origin.w + x * edgeX.w + y * edgeY.w + z * edgeZ.w;
+            const float scale = 1.0f / (cameraOffset4D - w);
+            const float projectedAbscissa = (origin.x + x * edgeX.x + y * edgeY.x + z * edgeZ.x) * scale;
+            const float projectedOrdinate = (origin.y + x * edgeX.y + y * edgeY.y + z * edgeZ.y) * scale;
+            const float projectedHeight = (origin.z + x * edgeX.z + y * edgeY.z + z * edgeZ.z) * scale;
+            projectedX[vertex] = projectedAbscissa;
+            projectedY[vertex] = projectedOrdinate;
+            projectedZ[vertex] = projectedHeight;
+            normalX[vertex] = constant.x + projectedOrdinate * slope.z - projectedHeight * slope.y;
+            normalY[vertex] = constant.y + projectedHeight * slope.x - projectedAbscissa * slope.z;
+            normalZ[vertex] = constant.z + projectedAbscissa * slope.y - projectedOrdinate * slope.x;
+        }
+        groupStart = groupEnd;
+    }
+}
@@ -11,11 +11,13 @@ float Window::poleRadius = 0.01f;
 double Window::scroll_speed = 0.2f;
 bool Window::leftButtonPressed = false;
 bool Window::wire_mesh = false;
+bool Window::gpuProjection = false;
+bool Window::flatShading = false;
 double Window::xpos = 0.0;
 double Window::ypos = 0.0;
 Menu Window::menu; //TODO: éviter cette chose, on doit pouvoir acceder à menu depuis des méthodes statiques (event handlers)
 
-Window::Window() : sponge() {
+Window::Window() : spongeGenerator() {
     initOpenGL();
     loadMainShaders();
     loadOverlayShaders();
@@ -29,10 +31,7 @@ Window::Window() : sponge() {
 void Window::projectHypercubeTo3D() {
     points[VAO_ID::WIRE_MESH].clear();
     for (glm::vec4 &V: hypercubePoints) {
-        glm::vec3 Vp = glm::vec3(V) / (cameraOffset4D - V.w);
-        points[VAO_ID::WIRE_MESH].push_back(Vp.x);
-        points[VAO_ID::WIRE_MESH].push_back(Vp.y);
-        points[VAO_ID::WIRE_MESH].push_back(Vp.z);
+        points[VAO_ID::WIRE_MESH].add(glm::vec3(V) / (cameraOffset4D - V.w));
     }
 }
 
@@ -43,10 +42,7 @@ void Window::projectHypercubeTo3D() {
 void Window::create3DCube(VAO_ID ID) {
     points[ID].clear();
     for (uint8_t index: cubesIndices[ID]) {
-        float *p = &points[VAO_ID::WIRE_MESH][index * 3];
-        points[ID].push_back(*(p + 0));
-        points[ID].push_back(*(p + 1));
-        points[ID].push_back(*(p + 2));
+        points[ID].add(points[VAO_ID::WIRE_MESH].get(index));
     }
 }
 
@@ -100,7 +96,10 @@ void Window::createMengerSpongeLikeHypercube() {
     for (uint8_t i = 0; i < 8; ++i) {
         create3DCube((VAO_ID) i);
     }
-    spongeWorker = new thread(&Window::computeVertexArray, this);
+    spongeWorker = thread(&Window::runSpongeWorker, this);
+    projectionWorker = thread(&Window::runProjectionWorker, this);
+    speculationWorker = thread(&Window::runSpeculationWorker, this);
+    requestSponge(spongeDepth);
 }
 
 /**
@@ -126,9 +125,12 @@ void Window::renderMengerSpongeLikeHypercube() {
         /* Push view and projection matrix to the gpu through uniforms */
         loadUniformMat4f(programMain, "view", view);
         loadUniformMat4f(programMain, "projection", projection);
+        viewProjection = projection * view;
 
         /* Update sponge depth workers and hypercube rotations if the user changed them */
         update();
+        /* Bring the visible chunks of a sponge too large for the memory to the GPU */
+        pageChunks(viewProjection);
 
         if (wire_mesh) {
             /* Draw projected hypercube wire mesh */
@@ -234,31 +236,529 @@ void Window::createArraysAndBuffers() {
 }
 
 /**
- * Uses the VAOs points array to create vertices, indices and normals
- * @param ID of the VAO used to store the data
+ * Loop of the sponge worker: wait for a request, generate its sponge, and again until the window is closed
  */
-void Window::computeVertexArray() {
-    try {
-        for (uint8_t ID = 0; ID < 8; ++ID) {
-            vertices[ID].clear();
-            indices[ID].clear();
-            normals[ID].clear();
-            /* Generate Menger's Sponge vertices and indices */
-            sponge.subdivide(spongeDepth, points[ID], vertices[ID], indices[ID]);
-            cout << "VAO[" << (VAO_ID) ID << "]: subdivided to " << vertices[ID].size() << " vertices and " << indices[ID].size() << " indices" << endl;
-            /* Duplicate vertices used by many "sides" to allow calculation of independent vertices normals */
-            Sponge::duplicateVertices(vertices[ID], indices[ID]);
-            cout << "VAO[" << (VAO_ID) ID << "]: duplicated to " << vertices[ID].size() << " vertices" << endl;
-            /* Compute said normals */
-            Sponge::computeSpongeNormals(vertices[ID], indices[ID], normals[ID]);
-            cout << "VAO[" << (VAO_ID) ID << "]: computed " << normals[ID].size() << " normals" << endl;
+void Window::runSpongeWorker() {
+    SpongeRequest request{};
+    while (true) {
+        {
+            /* The mailbox doesn't need the lock, it only puts the worker to sleep without missing a request */
+            unique_lock<mutex> lock(spongeWorkerMutex);
+            spongeWorkerWakeUp.wait(lock, [&]() { return spongeWorkerStopping || spongeRequests.take(request); });
+            if (spongeWorkerStopping) return;
         }
-        vertexComputationUpdated = true;
+        spongeWorkerSucceeded = computeCellSponge(request.depth);
+        spongeWorkerEndTime = chrono::steady_clock::now();
         spongeWorkerHasFinished = true;
+    }
+}
+
+/**
+ * Ask the sponge worker for the sponge of a depth, update shows it once it is handed over
+ * @param depth
+ */
+void Window::requestSponge(uint8_t depth) {
+    /* The previous sponge may still be read by a projection, the worker writes to a new one */
+    if (depth <= maxGpuSpongeDepth) {
+        nextCellSponge = make_shared<CellSponge>();
+    }
+    spongeCancellation.reset();
+    spongeRequestPending = true;
+    spongeRequests.post({depth});
+    wakeWorker(spongeWorkerMutex, spongeWorkerWakeUp);
+}
+
+/**
+ * Wake up a worker sleeping on a condition variable, without missing it if it is about to sleep
+ * @param workerMutex
+ * @param wakeUp
+ */
+void Window::wakeWorker(mutex &workerMutex, condition_variable &wakeUp) {
+    {
+        /* Taking the lock once makes sure the worker is either asleep or yet to check what it waits for */
+        lock_guard<mutex> lock(workerMutex);
+    }
+    wakeUp.notify_one();
+}
+
+/**
+ * Generate the sponge of a cube in cell space, run by the sponge worker
+ * @param depth
+ * @return true if the sponge was generated
+ */
+bool Window::computeCellSponge(uint8_t depth) {
+    try {
+        if (depth > maxGpuSpongeDepth) {
+            /* The sponge is too large for the memory, it is written to a file one chunk at a time */
+            if (!spongeGenerator.generateChunks(depth, *nextChunkStore, spongeCancellation)) return false;
+            cout << "Depth " << (int) depth << ": wrote " << nextChunkStore->getChunkCount() << " chunks of " << nextChunkStore->getUsedBytes() / (1u << 20u) << " MB in total" << endl;
+            return true;
+        }
+        /* Generate Menger's Sponge vertices and indices once for the 8 cubes, on every worker thread */
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!spongeGenerator.generateCellSponge(depth, *nextCellSponge, spongeCancellation)) return false;
+        spongeGenerationMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "Depth " << (int) depth << ": generated " << nextCellSponge->vertices.size() / 4 << " vertices and " << nextCellSponge->indices.size() << " indices in " << nextCellSponge->batches.size() << " batches per cube in " << spongeGenerationMilliseconds << " ms" << endl;
+        return true;
     } catch (const std::exception& e) {
         cout << e.what() << endl;
+        return false;
+    }
+}
+
+/**
+ * Ask the sponge worker to stop the sponge it generates, update collects it once the worker has ended
+ */
+void Window::cancelSpongeWorker() {
+    if (spongeRequestPending && !spongeCancellation.isCancelled()) {
+        spongeCancellationTime = chrono::steady_clock::now();
+        spongeCancellation.cancel();
+    }
+}
+
+/**
+ * Ask the projection worker to place the cell sponge in each of the rotated 4D cubes and project it to 3D, update
+ * uploads the projection once it is published. A projection found in the cache is uploaded at once
+ */
+void Window::projectCellSponge() {
+    /* The deepest sponges are only displayed by the GPU projection, a shallower one will replace them */
+    if (cellSponge->depth > maxSpongeDepth) {
+        return;
+    }
+
+    /* These rotations were seen recently at full depth, even a drag displays them */
+    shared_ptr<const ProjectedSponge> cachedProjection = projectionCache.find(getRotationKey(cellSponge->depth));
+    if (cachedProjection) {
+        projectedDepth = cellSponge->depth;
+        cachedProjectionSequence = ++projectionSequence;
+        uploadProjection(*cachedProjection);
+        logProjectionCache();
+        return;
+    }
+
+    /* Sponges are generated one depth after the other, the ones kept form a range up to the current one */
+    uint8_t shallowest = cellSponge->depth;
+    while (shallowest > 0 && cpuCellSponges[shallowest - 1]) {
+        --shallowest;
+    }
+    bool interacting = isInteracting();
+    uint8_t depth = depthScheduler.chooseDepth(interacting, shallowest, cellSponge->depth);
+    if (depth != projectedDepth) {
+        cout << (interacting ? "Dragging" : "Idle") << ": projecting depth " << (int) depth << ", expected to take " << depthScheduler.estimateLatency(depth) << " ms for a budget of " << depthScheduler.getBudget() << " ms" << endl;
+    }
+    projectedDepth = depth;
+    if (depth != cellSponge->depth) {
+        cachedProjection = projectionCache.find(getRotationKey(depth));
+        if (cachedProjection) {
+            cachedProjectionSequence = ++projectionSequence;
+            uploadProjection(*cachedProjection);
+            logProjectionCache();
+            return;
+        }
+    }
+    logProjectionCache();
+
+    ProjectionRequest request;
+    request.key = getRotationKey(depth);
+    request.sequence = ++projectionSequence;
+    request.cellSponge = cpuCellSponges[depth];
+    for (uint8_t ID = 0; ID < 8; ++ID) {
+        for (uint8_t corner = 0; corner < 8; ++corner) {
+            request.corners[8 * ID + corner] = hypercubePoints[cubesIndices[ID][corner]];
+        }
+    }
+    request.cameraOffset4D = cameraOffset4D;
+    projectionRequests.post(request);
+    wakeWorker(projectionWorkerMutex, projectionWorkerWakeUp);
+}
+
+/**
+ * Give the key of the current rotations in the projection cache
+ * @param depth
+ * @return the key
+ */
+RotationKey Window::getRotationKey(uint8_t depth) const {
+    float rotations[6];
+    getRotations(rotations);
+    return getRotationKey(rotations, depth);
+}
+
+/**
+ * Give the key of some rotations in the projection cache
+ * @param rotations
+ * @param depth
+ * @return the key
+ */
+RotationKey Window::getRotationKey(const float *rotations, uint8_t depth) {
+    RotationKey key{};
+    for (uint8_t rotation = 0; rotation < 6; ++rotation) {
+        key.rotations[rotation] = (uint16_t) lround(rotations[rotation] * (RotationKey::QUANTIZATION - 1));
+    }
+    key.depth = depth;
+    key.flatShading = flatShading;
+    return key;
+}
+
+/**
+ * @param rotations is an array where the 6 rotation gauge values will be written to
+ */
+void Window::getRotations(float *rotations) {
+    for (uint8_t rotation = 0; rotation < 6; ++rotation) {
+        rotations[rotation] = menu.getGaugeValue((Gauges) (Gauges::ROTATION_XY + rotation));
+    }
+}
+
+/**
+ * Predict the next positions of the dragged gauge and ask the speculation worker to project the ones that aren't
+ * cached, the previous request being cancelled if the drag didn't reach one of its positions
+ * @param rotations
+ */
+void Window::speculate(const float *rotations) {
+    /* The deepest sponges are only displayed by the GPU projection */
+    if (!menu.isInputCaptured() || cellSponge->depth > maxSpongeDepth) {
+        return;
+    }
+    RotationKey key = getRotationKey(rotations, cellSponge->depth);
+    if (find(speculatedKeys, speculatedKeys + speculatedKeyCount, key) == speculatedKeys + speculatedKeyCount) {
+        cancelSpeculation();
+    }
+    dragPredictor.record(rotations);
+
+    /* The predicted rotations are applied to the hypercube for their corners, then the current ones are put back */
+    vector<glm::vec4> currentPoints = hypercubePoints;
+    glm::mat4 currentRotation = hypercubeRotation;
+    SpeculationRequest request;
+    request.count = 0;
+    speculatedKeyCount = 0;
+    float predictedRotations[6];
+    for (uint8_t step = 1; step <= DragPredictor::PREDICTION_COUNT; ++step) {
+        if (!dragPredictor.predict(step, predictedRotations)) break;
+        RotationKey predictedKey = getRotationKey(predictedRotations, cellSponge->depth);
+        speculatedKeys[speculatedKeyCount++] = predictedKey;
+        if (projectionCache.contains(predictedKey)) continue;
+        rotateHypercube(predictedRotations);
+        for (uint8_t ID = 0; ID < 8; ++ID) {
+            for (uint8_t corner = 0; corner < 8; ++corner) {
+                request.corners[request.count][8 * ID + corner] = hypercubePoints[cubesIndices[ID][corner]];
+            }
+        }
+        request.keys[request.count++] = predictedKey;
+    }
+    hypercubePoints = currentPoints;
+    hypercubeRotation = currentRotation;
+    if (request.count == 0) {
         return;
     }
+
+    /* A request that wasn't cancelled keeps its token: its positions were reached or are still ahead */
+    if (!speculationCancellation || speculationCancellation->isCancelled()) {
+        speculationCancellation = make_shared<CancellationToken>();
+    }
+    request.cellSponge = cellSponge;
+    request.cancellation = speculationCancellation;
+    request.cameraOffset4D = cameraOffset4D;
+    speculationRequests.post(request);
+    wakeWorker(speculationWorkerMutex, speculationWorkerWakeUp);
+}
+
+/**
+ * Cancel the request the speculation worker works on, without waiting for it
+ */
+void Window::cancelSpeculation() {
+    if (speculationCancellation) {
+        speculationCancellation->cancel();
+    }
+    speculatedKeyCount = 0;
+}
+
+/**
+ * Loop of the speculation worker: wait for a request, project each of its positions into the projection cache unless
+ * it is cancelled, and again until the window is closed
+ */
+void Window::runSpeculationWorker() {
+    SpeculationRequest request;
+    bool requestTaken = false;
+    while (true) {
+        if (!requestTaken) {
+            unique_lock<mutex> lock(speculationWorkerMutex);
+            speculationWorkerWakeUp.wait(lock, [&]() {
+                return speculationWorkerStopping || speculationRequests.take(request);
+            });
+            if (speculationWorkerStopping) return;
+        }
+        requestTaken = false;
+        for (uint8_t position = 0; position < request.count; ++position) {
+            /* The projection worker may have cached the position since it was predicted */
+            if (projectionCache.contains(request.keys[position])) continue;
+            shared_ptr<ProjectedSponge> projection = make_shared<ProjectedSponge>();
+            projection->cellSponge = request.cellSponge;
+            copy(request.corners[position], request.corners[position] + 8 * 8, projection->corners);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            PointArrays *normals = request.keys[position].flatShading ? nullptr : projection->normals;
+            if (!spongeGenerator.projectInBackground(*request.cellSponge, request.corners[position], 8,
+                                                     request.cameraOffset4D, projection->vertices, normals,
+                                                     *request.cancellation)) {
+                ++speculationsCancelled;
+                break;
+            }
+            projection->projectionMilliseconds =
+                    chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            projection->sequence = 0;
+            uint64_t bytes = 0;
+            for (uint8_t ID = 0; ID < 8; ++ID) {
+                bytes += projection->vertices[ID].getBytes() + projection->normals[ID].getBytes();
+            }
+            projectionCache.insert(request.keys[position], projection, bytes);
+            ++speculationsCompleted;
+            /* A newer request predicts from further along the drag, the rest of this one is left behind */
+            if (speculationRequests.take(request)) {
+                requestTaken = true;
+                break;
+            }
+        }
+        if (!requestTaken) {
+            /* The request is done, it doesn't keep its sponge alive */
+            request.cellSponge.reset();
+            request.cancellation.reset();
+        }
+    }
+}
+
+/**
+ * Report the hit rate and the memory use of the projection cache, every 64 lookups
+ */
+void Window::logProjectionCache() const {
+    uint64_t hits = projectionCache.getHits();
+    uint64_t lookups = hits + projectionCache.getMisses();
+    if (lookups == 0 || lookups % 64 != 0) return;
+    cout << "Projection cache: " << 100 * hits / lookups << "% of " << lookups << " lookups hit, " << projectionCache.getEntryCount() << " projections in " << projectionCache.getUsedBytes() / (1u << 20u) << " MB, " << speculationsCompleted << " speculative projections made and " << speculationsCancelled << " cancelled" << endl;
+}
+
+/**
+ * Loop of the projection worker: wait for a request and for the previous projection to be taken, project the sponge,
+ * cache it, and again until the window is closed
+ */
+void Window::runProjectionWorker() {
+    ProjectionRequest request;
+    while (true) {
+        {
+            /* The back copy is the one the render thread read until it took the last projection, it waits for that.
+             * Requests posted meanwhile are coalesced by the mailbox, only the latest one is projected */
+            unique_lock<mutex> lock(projectionWorkerMutex);
+            projectionWorkerWakeUp.wait(lock, [&]() {
+                return projectionWorkerStopping ||
+                       (projectedSponges.isWritable() && projectionRequests.take(request));
+            });
+            if (projectionWorkerStopping) return;
+        }
+        ProjectedSponge &projection = projectedSponges.getBack();
+        projection.cellSponge = request.cellSponge;
+        copy(request.corners, request.corners + 8 * 8, projection.corners);
+        /* A flat shaded projection doesn't keep the normals the back copy had */
+        PointArrays *normals = projection.normals;
+        if (request.key.flatShading) {
+            normals = nullptr;
+            for (PointArrays &cubeNormals : projection.normals) {
+                cubeNormals = PointArrays();
+            }
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        spongeGenerator.project(*request.cellSponge, request.corners, 8, request.cameraOffset4D, projection.vertices,
+                                normals);
+        projection.projectionMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        projection.sequence = request.sequence;
+        projectedSponges.publish();
+        /* The published copy is only read from now on, so it is copied to the cache after the render thread got it.
+         * The copy is made here rather than by the render thread, which only takes a pointer on a cache hit */
+        uint64_t bytes = 0;
+        for (uint8_t ID = 0; ID < 8; ++ID) {
+            bytes += projection.vertices[ID].getBytes() + projection.normals[ID].getBytes();
+        }
+        projectionCache.insert(request.key, make_shared<ProjectedSponge>(projection), bytes);
+        /* The request is done, it doesn't keep its sponge alive */
+        request.cellSponge.reset();
+    }
+}
+
+/**
+ * @return true if the user is dragging a gauge and moved it within idleDelay
+ */
+bool Window::isInteracting() const {
+    return menu.isInputCaptured() && chrono::steady_clock::now() - lastRotationTime < idleDelay;
+}
+
+/**
+ * Display the sponge kept by the worker in place of the current one
+ */
+void Window::showNextCellSponge() {
+    swap(cellSponge, nextCellSponge);
+    spongeDepth = cellSponge->depth;
+    cellSpongeUploaded = false;
+    if (cellSponge->depth <= maxSpongeDepth) {
+        cpuCellSponges[cellSponge->depth] = cellSponge;
+    }
+    if (!gpuProjection) {
+        projectCellSponge();
+    }
+}
+
+/**
+ * Display the sponge the worker wrote in chunks in place of the current one, it is only displayed by the GPU projection
+ */
+void Window::showNextChunkedSponge() {
+    releaseChunks();
+    swap(chunkStore, nextChunkStore);
+    /* The shallower chunked sponge isn't needed anymore, neither is the cell sponge on the GPU (its buffers are
+     * emptied through the array buffer target, which leaves the bound vertex array untouched) */
+    nextChunkStore->close();
+    glBindBuffer(GL_ARRAY_BUFFER, VBO[VAO_ID::CELL_SPONGE]);
+    glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, IBO[VAO_ID::CELL_SPONGE]);
+    glBufferData(GL_ARRAY_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+    cellSpongeUploaded = false;
+
+    chunkResidency.assign(chunkStore->getChunkCount(), -1);
+    chunkVisibility.assign(chunkStore->getChunkCount(), 0);
+    chunkDistances.assign(chunkStore->getChunkCount(), 0.0f);
+    spongeDepth = chunkStore->getDepth();
+    chunkedSponge = true;
+}
+
+/**
+ * Find the chunks of the chunked sponge that are visible in each cube, then upload the closest ones that aren't on the
+ * GPU yet within the upload budget of a frame, evicting the chunks that weren't visible for the longest time to stay
+ * within the GPU memory budget
+ * @param viewProjection is the view and projection matrix of the frame
+ */
+void Window::pageChunks(const glm::mat4 &viewProjection) {
+    if (!chunkedSponge || !gpuProjection || wire_mesh) {
+        return;
+    }
+    ++frameNumber;
+
+    /* Transform from cell space to clip space of each cube that isn't fully transparent. Placing a point in the 4D
+     * cell and projecting it is linear in homogeneous coordinates, the divisor being the distance to the camera along
+     * W, so a chunk is out of view when the 8 corners of its cube are outside of the same clip plane */
+    glm::mat4 cellToClip[8];
+    uint8_t shownCubes = 0;
+    for (uint8_t ID = 0; ID < 8; ++ID) {
+        if (menu.getGaugeValue((Gauges) ID) == 0) continue;
+        shownCubes |= 1u << ID;
+        glm::vec4 corners[8];
+        for (uint8_t corner = 0; corner < 8; ++corner) {
+            corners[corner] = hypercubePoints[cubesIndices[ID][corner]];
+        }
+        cellToClip[ID] = viewProjection * getCellToWorld(corners, (VAO_ID) ID, 0);
+    }
+
+    vector<uint32_t> missingChunks;
+    float latticeSize = chunkStore->getLatticeSize();
+    for (uint32_t chunk = 0; chunk < chunkStore->getChunkCount(); ++chunk) {
+        chunkVisibility[chunk] = 0;
+        if (!chunkStore->isReady(chunk)) continue;
+
+        const LatticeCube &cube = chunkStore->getChunk(chunk).cube;
+        glm::vec3 lowest = glm::vec3(cube.origin[0], cube.origin[1], cube.origin[2]) / latticeSize;
+        float size = cube.size / latticeSize;
+        chunkDistances[chunk] = 1e30f;
+        for (uint8_t ID = 0; ID < 8; ++ID) {
+            if (!(shownCubes & (1u << ID))) continue;
+
+            uint8_t outside[6] = {0, 0, 0, 0, 0, 0};
+            bool behindCamera = false;
+            for (uint8_t corner = 0; corner < 8; ++corner) {
+                glm::vec3 point = lowest + size * glm::vec3(corner & 1u, (corner >> 1u) & 1u, (corner >> 2u) & 1u);
+                glm::vec4 clip = cellToClip[ID] * glm::vec4(point, 1.0f);
+                behindCamera |= clip.w <= 0.0f;
+                for (uint8_t axis = 0; axis < 3; ++axis) {
+                    outside[2 * axis] += clip[axis] < -clip.w;
+                    outside[2 * axis + 1] += clip[axis] > clip.w;
+                }
+                chunkDistances[chunk] = min(chunkDistances[chunk], clip.w);
+            }
+            if (behindCamera || *max_element(outside, outside + 6) < 8) {
+                chunkVisibility[chunk] |= 1u << ID;
+            }
+        }
+
+        /* Visible chunks on the GPU stay there, the others are requested */
+        if (chunkVisibility[chunk] != 0) {
+            if (chunkResidency[chunk] >= 0) {
+                residentChunks[chunkResidency[chunk]].lastVisibleFrame = frameNumber;
+            } else {
+                missingChunks.push_back(chunk);
+            }
+        }
+    }
+
+    /* Upload the closest chunks first */
+    sort(missingChunks.begin(), missingChunks.end(),
+         [&](uint32_t a, uint32_t b) { return chunkDistances[a] < chunkDistances[b]; });
+    uint64_t uploadedBytes = 0;
+    for (uint32_t chunk : missingChunks) {
+        const SpongeChunk &description = chunkStore->getChunk(chunk);
+        uint64_t bytes = description.vertexCount * 4 * sizeof(uint16_t) + description.indexCount * sizeof(uint16_t);
+        if (uploadedBytes > 0 && uploadedBytes + bytes > chunkUploadBudget) break;
+        while (residentChunkBytes + bytes > chunkMemoryBudget && evictChunk()) {}
+        /* Every chunk on the GPU is visible, the farther ones will wait */
+        if (residentChunkBytes + bytes > chunkMemoryBudget) break;
+
+        ResidentChunk resident = {chunk, 0, 0, 0, bytes, frameNumber, {}};
+        glGenVertexArrays(1, &resident.vertexArray);
+        glGenBuffers(1, &resident.vertexBuffer);
+        glGenBuffers(1, &resident.indexBuffer);
+        /* The chunk is read from the mapped file, the system loads its pages as they are copied */
+        fillLatticeVertexArray(resident.vertexArray, resident.vertexBuffer, resident.indexBuffer,
+                               chunkStore->getVertices(description), description.vertexCount,
+                               chunkStore->getIndices(description), description.indexCount);
+        setBatches(resident.draw, chunkStore->getBatches(description), description.batchCount);
+        chunkResidency[chunk] = residentChunks.size();
+        residentChunks.push_back(resident);
+        residentChunkBytes += bytes;
+        uploadedBytes += bytes;
+    }
+}
+
+/**
+ * Remove the chunk that wasn't visible for the longest time from the GPU, unless it is visible in this frame
+ * @return true if a chunk was removed
+ */
+bool Window::evictChunk() {
+    uint32_t oldest = min_element(residentChunks.begin(), residentChunks.end(),
+                                  [](const ResidentChunk &a, const ResidentChunk &b) {
+                                      return a.lastVisibleFrame < b.lastVisibleFrame;
+                                  }) - residentChunks.begin();
+    if (oldest == residentChunks.size() || residentChunks[oldest].lastVisibleFrame == frameNumber) {
+        return false;
+    }
+
+    ResidentChunk &resident = residentChunks[oldest];
+    glDeleteVertexArrays(1, &resident.vertexArray);
+    glDeleteBuffers(1, &resident.vertexBuffer);
+    glDeleteBuffers(1, &resident.indexBuffer);
+    residentChunkBytes -= resident.bytes;
+    chunkResidency[resident.chunk] = -1;
+    /* The last chunk takes the place of the removed one */
+    resident = residentChunks.back();
+    residentChunks.pop_back();
+    if (oldest < residentChunks.size()) {
+        chunkResidency[resident.chunk] = oldest;
+    }
+    return true;
+}
+
+/**
+ * Remove every chunk from the GPU
+ */
+void Window::releaseChunks() {
+    for (const ResidentChunk &resident : residentChunks) {
+        glDeleteVertexArrays(1, &resident.vertexArray);
+        glDeleteBuffers(1, &resident.vertexBuffer);
+        glDeleteBuffers(1, &resident.indexBuffer);
+        chunkResidency[resident.chunk] = -1;
+    }
+    residentChunks.clear();
+    residentChunkBytes = 0;
 }
 
 /**
@@ -267,111 +767,209 @@ void Window::computeVertexArray() {
  * Manage existing sponge computing thread
  */
 void Window::update() {
-    /* Ensures that current thread is either working or completely dead */
-    if (spongeWorker != nullptr && spongeWorkerHasFinished) {
-        spongeWorker->join();
-        spongeWorker = nullptr;
+    /* Collect the sponge handed over by the worker, which then waits for the next request */
+    if (spongeRequestPending && spongeWorkerHasFinished) {
+        spongeWorkerHasFinished = false;
+        spongeRequestPending = false;
+        if (!spongeWorkerSucceeded) {
+            /* The worker left an incomplete sponge, the depth goes back to the displayed one */
+            if (spongeCancellation.isCancelled()) {
+                double latency = chrono::duration<double, milli>(spongeWorkerEndTime - spongeCancellationTime).count();
+                cout << "Depth " << (int) spongeDepth << ": cancelled, the worker stopped after " << latency << " ms" << endl;
+            } else {
+                failedSpongeDepth = spongeDepth;
+            }
+            nextChunkStore->close();
+            spongeDepth = chunkedSponge ? chunkStore->getDepth() : cellSponge->depth;
+        } else if (spongeDepth > maxGpuSpongeDepth) {
+            /* The sponge of the new depth replaces the displayed one */
+            showNextChunkedSponge();
+        } else {
+            depthScheduler.recordGeneration(spongeDepth, spongeGenerationMilliseconds);
+            showNextCellSponge();
+        }
+    }
+
+    /* A chunked sponge is only displayed by the GPU projection, a worker still writing one is stopped */
+    if (spongeRequestPending && !gpuProjection && spongeDepth > maxGpuSpongeDepth) {
+        cancelSpongeWorker();
+    }
+
+    /* The CPU projection falls back to the cell sponge, the chunked one will be generated again if needed */
+    if (chunkedSponge && !gpuProjection) {
+        releaseChunks();
+        chunkStore->close();
+        chunkedSponge = false;
+        spongeDepth = cellSponge->depth;
+    }
+
+    /* The worker keeps the previous sponge, so switching between projections only swaps them when the current one is
+     * too deep for the CPU projection, or when the next depth is already available */
+    uint8_t depthLimit = gpuProjection ? maxChunkedSpongeDepth : maxSpongeDepth;
+    uint8_t cellSpongeDepthLimit = gpuProjection ? maxGpuSpongeDepth : maxSpongeDepth;
+    if (!spongeRequestPending && !chunkedSponge &&
+        (cellSponge->depth > cellSpongeDepthLimit ||
+         (cellSponge->depth < cellSpongeDepthLimit && nextCellSponge->depth == cellSponge->depth + 1))) {
+        showNextCellSponge();
+    }
+
+    /* If the user changed the rotation parameters, re-compute hypercube and re-project the sponge */
+    if (menu.rotationWasModified) {
+        updateRotations();
+    }
+
+    /* A gauge released or held still won't reach the positions predicted while it was dragged, the full depth
+     * projection of its position below gets every core */
+    if (speculatedKeyCount > 0 && !isInteracting()) {
+        cancelSpeculation();
+        dragPredictor.reset();
+    }
+
+    /* Once the gauge is released or held still, the sponge projected at a shallower depth while it moved is refined */
+    if (!gpuProjection && !wire_mesh && projectedDepth < cellSponge->depth && cellSponge->depth <= maxSpongeDepth &&
+        !isInteracting()) {
+        projectCellSponge();
+    }
+
+    /* When the GPU projects the sponge, it only needs to receive it once per depth */
+    if (gpuProjection && !cellSpongeUploaded && !chunkedSponge && !wire_mesh) {
+        fillCellSpongeVertexArray();
     }
 
-    /* If a new computation has finished, send all the data to the GPU */
-    if (spongeWorker == nullptr && vertexComputationUpdated) {
+    /* If the wire mesh was re-created, send it to the GPU */
+    if (vertexComputationUpdated) {
         if (wire_mesh) {
             fillWireMeshVertexArray();
-        } else {
-            for (uint8_t ID = 0; ID < 8; ++ID) {
-                fillSpongeVertexArray((VAO_ID) ID);
-            }
         }
         vertexComputationUpdated = false;
     }
 
-    /* If the user changed the rotation parameters, re-compute hypercube and sponge vertices */
-    if (menu.rotationWasModified) {
-        updateRotations();
+    /* Send the projection published by the projection worker to the GPU, the previous one is drawn until then. It is
+     * dropped if a projection of later rotations was found in the cache meanwhile */
+    if (!gpuProjection && !wire_mesh && projectedSponges.take()) {
+        const ProjectedSponge &projection = projectedSponges.getFront();
+        /* The scheduler learns what an interaction costs at this depth */
+        depthScheduler.recordProjection(projection.cellSponge->depth, projection.projectionMilliseconds);
+        if (projection.sequence > cachedProjectionSequence) {
+            uploadProjection(projection);
+        }
+        /* The worker may now write the copy that was read until then */
+        wakeWorker(projectionWorkerMutex, projectionWorkerWakeUp);
     }
 
-    /* If we aren't at maximum depth, launch a new sponge computing thread with a bigger depth */
-    if (spongeWorker == nullptr && spongeDepth != maxSpongeDepth && !wire_mesh) {
-        spongeDepth = min((uint8_t) (spongeDepth + 1), maxSpongeDepth);
-        Sponge::killComputation = false;
-        spongeWorkerHasFinished = false;
-        spongeWorker = new thread(&Window::computeVertexArray, this);
+    /* If we aren't at maximum depth, ask the worker for the sponge of the next depth */
+    if (!spongeRequestPending && spongeDepth < depthLimit && spongeDepth + 1 < failedSpongeDepth && !wire_mesh) {
+        spongeDepth++;
+        requestSponge(spongeDepth);
     }
 }
 
 /**
  * Transform the hypercube by the new rotations parameters and re-compute the individual cubes
- * Then resets depth to 1 and launch a sponge computing thread
+ * Then re-project the current sponge, keeping its depth
  */
 void Window::updateRotations() {
     menu.rotationWasModified = false;
+    float rotations[6];
+    getRotations(rotations);
+    rotateHypercube(rotations);
+    /* Project from 4D to 3D */
+    projectHypercubeTo3D();
+    /* Re-create cubes */
+    for (uint8_t i = 0; i < 8; ++i) {
+        create3DCube((VAO_ID) i);
+    }
+
+    /* The sponge topology doesn't depend on the rotations, only its projection has to be done again, unless the
+     * GPU does it from the rotation matrix */
+    vertexComputationUpdated = true;
+    lastRotationTime = chrono::steady_clock::now();
+    if (!gpuProjection) {
+        projectCellSponge();
+        speculate(rotations);
+    }
+}
+
+/**
+ * Reset the hypercube, then apply the rotations of the gauges to it
+ * @param rotations
+ */
+void Window::rotateHypercube(const float *rotations) {
     /* Reset transformations */
     init4DRotations();
     /* Apply all 4D rotations */
-    if (menu.getGaugeValue(Gauges::ROTATION_XY) != 0) {
-        rotateXY(menu.getGaugeValue(Gauges::ROTATION_XY) * PI2);
-    }
-    if (menu.getGaugeValue(Gauges::ROTATION_YZ) != 0) {
-        rotateYZ(menu.getGaugeValue(Gauges::ROTATION_YZ) * PI2);
+    if (rotations[0] != 0) {
+        rotateXY(rotations[0] * PI2);
     }
-    if (menu.getGaugeValue(Gauges::ROTATION_ZX) != 0) {
-        rotateZX(menu.getGaugeValue(Gauges::ROTATION_ZX) * PI2);
+    if (rotations[1] != 0) {
+        rotateYZ(rotations[1] * PI2);
     }
-    if (menu.getGaugeValue(Gauges::ROTATION_XW) != 0) {
-        rotateXW(menu.getGaugeValue(Gauges::ROTATION_XW) * PI2);
+    if (rotations[2] != 0) {
+        rotateZX(rotations[2] * PI2);
     }
-    if (menu.getGaugeValue(Gauges::ROTATION_YW) != 0) {
-        rotateYW(menu.getGaugeValue(Gauges::ROTATION_YW) * PI2);
+    if (rotations[3] != 0) {
+        rotateXW(rotations[3] * PI2);
     }
-    if (menu.getGaugeValue(Gauges::ROTATION_ZW) != 0) {
-        rotateZW(menu.getGaugeValue(Gauges::ROTATION_ZW) * PI2);
+    if (rotations[4] != 0) {
+        rotateYW(rotations[4] * PI2);
     }
-    /* Project from 4D to 3D */
-    projectHypercubeTo3D();
-    /* Re-create cubes */
-    for (uint8_t i = 0; i < 8; ++i) {
-        create3DCube((VAO_ID) i);
+    if (rotations[5] != 0) {
+        rotateZW(rotations[5] * PI2);
     }
+}
 
-    /* Resets depth to 1 */
-    spongeDepth = 1;
-    /* Kill the actual sponge computing thread if alive */
-    if (spongeWorker != nullptr) {
-        Sponge::killComputation = true;
-        spongeWorker->join();
+/**
+ * Send a projected sponge to the GPU, it is drawn from then on
+ * @param projection
+ */
+void Window::uploadProjection(const ProjectedSponge &projection) {
+    bool uploadIndices = projection.cellSponge != uploadedProjectionSponge;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (uint8_t ID = 0; ID < 8; ++ID) {
+        fillSpongeVertexArray((VAO_ID) ID, projection, uploadIndices);
     }
-    /* Launch a new sponge computing thread with updated depth */
-    Sponge::killComputation = false;
-    spongeWorkerHasFinished = false;
-    spongeWorker = new thread(&Window::computeVertexArray, this);
+    double uploadMilliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    depthScheduler.recordUpload(projection.cellSponge->depth, uploadMilliseconds);
+    uploadedProjectionSponge = projection.cellSponge;
+    uploadedProjectionNormals = !projection.normals[0].empty();
+    copy(projection.corners, projection.corners + 8 * 8, uploadedProjectionCorners);
 }
 
 /**
  * Load vertices, normals and indices to buffers
  * @param ID of the VAO used to store the data
  */
-void Window::fillSpongeVertexArray(VAO_ID ID) {
+void Window::fillSpongeVertexArray(VAO_ID ID, const ProjectedSponge &projection, bool uploadIndices) {
     /* Bind wanted vertex array */
     glBindVertexArray(VAO[ID]);
     /* Bind vertex buffer to vertex array */
     glBindBuffer(GL_ARRAY_BUFFER, VBO[ID]);
     /* Buffer vertices to vertex buffer */
-    glBufferData(GL_ARRAY_BUFFER, (long) (vertices[ID].size() * sizeof(float)), vertices[ID].data(), GL_STATIC_DRAW);
+    bufferPoints(projection.vertices[ID]);
     /* Assign the buffer content to vertex array pointer 0 */
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) nullptr);
     glEnableVertexAttribArray(0);
     /* Bind normals buffer to vertex array */
     glBindBuffer(GL_ARRAY_BUFFER, NBO[ID]);
-    /* Buffer normals to normal buffer */
-    glBufferData(GL_ARRAY_BUFFER, (long) (normals[ID].size() * sizeof(float)), normals[ID].data(), GL_STATIC_DRAW);
-    /* Assign the buffer content to vertex array pointer 1 */
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) nullptr);
-    glEnableVertexAttribArray(1);
+    /* Buffer normals to normal buffer, a flat shaded projection has none and empties it */
+    bufferPoints(projection.normals[ID]);
+    if (projection.normals[ID].empty()) {
+        glDisableVertexAttribArray(1);
+    } else {
+        /* Assign the buffer content to vertex array pointer 1 */
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) nullptr);
+        glEnableVertexAttribArray(1);
+    }
     /* Bind indices buffer to vertex array */
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO[ID]);
-    /* Buffer indices to vertex buffer */
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long) (indices[ID].size() * sizeof(uint32_t)), indices[ID].data(), GL_STATIC_DRAW);
-    currentIndicesCount[ID] = indices[ID].size();
+    /* Indices are shared by every cube and only change with the depth */
+    if (uploadIndices) {
+        /* Buffer indices to vertex buffer */
+        const vector<uint16_t> &spongeIndices = projection.cellSponge->indices;
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long) (spongeIndices.size() * sizeof(uint16_t)), spongeIndices.data(), GL_STATIC_DRAW);
+        const vector<IndexBatch> &batches = projection.cellSponge->batches;
+        setBatches(spongeDraws[ID], batches.data(), batches.size());
+    }
 }
 
 /**
@@ -384,7 +982,7 @@ void Window::fillWireMeshVertexArray() {
     /* Bind vertex buffer to vertex array */
     glBindBuffer(GL_ARRAY_BUFFER, VBO[VAO_ID::WIRE_MESH]);
     /* Buffer vertices to vertex buffer */
-    glBufferData(GL_ARRAY_BUFFER, (long) (points[VAO_ID::WIRE_MESH].size() * sizeof(float)), points[VAO_ID::WIRE_MESH].data(), GL_STATIC_DRAW);
+    bufferPoints(points[VAO_ID::WIRE_MESH]);
     /* Assign the buffer content to vertex array pointer 0 */
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*) nullptr);
     glEnableVertexAttribArray(0);
@@ -395,6 +993,94 @@ void Window::fillWireMeshVertexArray() {
     currentIndicesCount[VAO_ID::WIRE_MESH] = indices[VAO_ID::WIRE_MESH].size();
 }
 
+/**
+ * Load the cell sponge, given in cell space, to the buffers shared by every cube when the projection is done on the GPU
+ */
+void Window::fillCellSpongeVertexArray() {
+    fillLatticeVertexArray(VAO[VAO_ID::CELL_SPONGE], VBO[VAO_ID::CELL_SPONGE], IBO[VAO_ID::CELL_SPONGE],
+                           cellSponge->vertices.data(), cellSponge->vertices.size() / 4, cellSponge->indices.data(),
+                           cellSponge->indices.size());
+    setBatches(spongeDraws[VAO_ID::CELL_SPONGE], cellSponge->batches.data(), cellSponge->batches.size());
+    cellSpongeUploaded = true;
+}
+
+/**
+ * Load a sponge given in cell space to a vertex array and its buffers
+ * @param vertexArray is the vertex array to set up
+ * @param vertexBuffer receives the vertices, 4 unsigned shorts each (see CellSponge)
+ * @param indexBuffer receives the indices
+ * @param vertices is an array of vertexCount vertices
+ * @param vertexCount is the number of vertices
+ * @param indices is an array of indexCount indices
+ * @param indexCount is the number of indices
+ */
+void Window::fillLatticeVertexArray(uint32_t vertexArray, uint32_t vertexBuffer, uint32_t indexBuffer,
+                                    const uint16_t *vertices, uint64_t vertexCount, const uint16_t *indices,
+                                    uint64_t indexCount) {
+    /* Bind wanted vertex array */
+    glBindVertexArray(vertexArray);
+    /* Bind vertex buffer to vertex array */
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    /* Buffer lattice vertices to vertex buffer, 4 unsigned shorts each */
+    glBufferData(GL_ARRAY_BUFFER, (long) (vertexCount * 4 * sizeof(uint16_t)), vertices, GL_STATIC_DRAW);
+    /* Assign the lattice coordinates to vertex array pointer 0 */
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, 4 * sizeof(uint16_t), (GLvoid*) nullptr);
+    glEnableVertexAttribArray(0);
+    /* Assign the face orientation to vertex array pointer 2, the normal is derived from it */
+    glVertexAttribPointer(2, 1, GL_UNSIGNED_SHORT, GL_FALSE, 4 * sizeof(uint16_t), (GLvoid*) (3 * sizeof(uint16_t)));
+    glEnableVertexAttribArray(2);
+    /* Bind indices buffer to vertex array */
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    /* Buffer indices to vertex buffer */
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long) (indexCount * sizeof(uint16_t)), indices, GL_STATIC_DRAW);
+}
+
+/**
+ * Give the draw of a mesh whose indices were uploaded in batches
+ * @param draw is where the draw will be written to
+ * @param batches is an array of batchCount batches
+ * @param batchCount is the number of batches
+ */
+void Window::setBatches(BatchedDraw &draw, const IndexBatch *batches, uint64_t batchCount) {
+    draw.counts.resize(batchCount);
+    draw.offsets.resize(batchCount);
+    draw.baseVertices.resize(batchCount);
+    for (uint64_t batch = 0; batch < batchCount; ++batch) {
+        draw.counts[batch] = (GLsizei) batches[batch].indexCount;
+        draw.offsets[batch] = (const void *) (batches[batch].firstIndex * sizeof(uint16_t));
+        draw.baseVertices[batch] = (GLint) batches[batch].firstVertex;
+    }
+}
+
+/**
+ * Draw the triangles of the bound vertex array, every batch in a single call
+ * @param draw is the draw of the mesh
+ */
+void Window::drawBatches(const BatchedDraw &draw) {
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, draw.counts.data(), GL_UNSIGNED_SHORT, draw.offsets.data(),
+                                  (GLsizei) draw.counts.size(), draw.baseVertices.data());
+}
+
+/**
+ * Load points to the bound array buffer as x, y, z triplets
+ * @param points are the points to load
+ */
+void Window::bufferPoints(const PointArrays &points) {
+    /* The buffer is mapped so that the coordinates are interleaved once, straight into the memory the driver copies
+     * from, rather than into a scratch array first */
+    const long bytes = (long) points.getBytes();
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+    if (bytes == 0) return;
+    void *target = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (target != nullptr) {
+        points.interleave(static_cast<float *>(target));
+        if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE) return;
+    }
+    /* The mapping failed or its content was lost, the points are given to the driver the slow way */
+    vector<float> interleaved(3 * points.size());
+    points.interleave(interleaved.data());
+    glBufferData(GL_ARRAY_BUFFER, bytes, interleaved.data(), GL_STATIC_DRAW);
+}
 
 /**
  * Initialize overlay texture buffer and position vertices
@@ -472,21 +1158,104 @@ void Window::loadUniform1i(uint32_t program, const char *name, int32_t value) {
 }
 
 /**
- * Binds the selected VAO and draw it's content
+ * Give the model matrix of a cube, which unfolds the hypercube
+ * @param ID of the cube
+ * @return
+ */
+glm::mat4 Window::getCubeModel(VAO_ID ID) const {
+    return glm::mat4(1.0f) + glm::translate(glm::mat4(menu.getGaugeValue(Gauges::UNFOLDING)), 2.0f * unfoldAxis[ID]);
+}
+
+/**
+ * Binds the selected VAO and draw it's content, without the meshlets of the sponge that can't be seen
  * @param ID of the VAO to draw
+ * @param drawIndex moves very slightly the cubes drawn later towards the camera, to avoid overlapping
  */
-void Window::drawVAOContents(VAO_ID ID) {
-    /* Bind vertex array object */
-    glBindVertexArray(VAO[ID]);
+void Window::drawVAOContents(VAO_ID ID, int32_t drawIndex) {
+    /* Bind vertex array object, every cube shares the cell sponge when the GPU places it in the cubes */
+    VAO_ID vertexArray = gpuProjection ? VAO_ID::CELL_SPONGE : ID;
+    glBindVertexArray(VAO[vertexArray]);
     glUseProgram(programMain);
-
-    /* Model matrix */
-    glm::mat4 model = glm::mat4(1.0f) + glm::translate(glm::mat4(menu.getGaugeValue(Gauges::UNFOLDING)), 2.0f * unfoldAxis[ID]);
+    loadUniform1i(programMain, "drawIndex", drawIndex);
 
     /* Push model matrix to gpu through uniform */
-    loadUniformMat4f(programMain, "model", model);
+    loadUniformMat4f(programMain, "model", getCubeModel(ID));
+    /* The CPU projection displayed may still be the one made before flat shading was toggled */
+    loadUniform1i(programMain, "flatShading", gpuProjection ? flatShading : !uploadedProjectionNormals);
+    /* Push the 4D cell of the cube, the vertex shader rotates and projects it */
+    loadUniform1i(programMain, "projectFrom4D", gpuProjection);
+    if (gpuProjection) {
+        loadUniformMat4f(programMain, "rotation", hypercubeRotation);
+        loadUniform1f(programMain, "cameraOffset4D", cameraOffset4D);
+        loadUniform1f(programMain, "latticeSize", chunkedSponge ? chunkStore->getLatticeSize() : cellSponge->latticeSize);
+        loadUniformVec4f(programMain, "cellCorners[0]", baseHypercubePoints[cubesIndices[ID][0]]);
+        loadUniformVec4f(programMain, "cellCorners[1]", baseHypercubePoints[cubesIndices[ID][1]]);
+        loadUniformVec4f(programMain, "cellCorners[2]", baseHypercubePoints[cubesIndices[ID][2]]);
+        loadUniformVec4f(programMain, "cellCorners[3]", baseHypercubePoints[cubesIndices[ID][4]]);
+    }
+    if (gpuProjection && chunkedSponge) {
+        /* Draw the chunks of the sponge on the GPU that are visible in this cube */
+        for (const ResidentChunk &resident : residentChunks) {
+            if (chunkVisibility[resident.chunk] & (1u << ID)) {
+                glBindVertexArray(resident.vertexArray);
+                drawBatches(resident.draw);
+            }
+        }
+        return;
+    }
+
+    /* Skip the meshlets that can't be seen, the ones looking away from the camera only when the cube is opaque: its
+     * sponge is a closed surface, they are then hidden behind the others */
+    const CellSponge *drawnSponge = gpuProjection ? cellSponge.get() : uploadedProjectionSponge.get();
+    if (drawnSponge == nullptr || drawnSponge->meshlets.empty()) {
+        drawBatches(spongeDraws[vertexArray]);
+        return;
+    }
+    glm::vec4 corners[8];
+    for (uint8_t corner = 0; corner < 8; ++corner) {
+        corners[corner] = gpuProjection ? hypercubePoints[cubesIndices[ID][corner]]
+                                        : uploadedProjectionCorners[8 * ID + corner];
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    meshletCuller.cull(*drawnSponge, getCellToWorld(corners, ID, drawIndex), viewProjection, cameraPosition,
+                       menu.getGaugeValue((Gauges) ID) == 1.0f, visibleRanges);
+    setBatches(visibleDraw, visibleRanges.data(), visibleRanges.size());
+    cullingMilliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
     /* Draw vertices and create fragments with triangles */
-    glDrawElements(GL_TRIANGLES, (int32_t) currentIndicesCount[ID], GL_UNSIGNED_INT, nullptr);
+    drawBatches(visibleDraw);
+}
+
+/**
+ * Give the map from the unit cube of cell space to world space of a cube: its cell is placed in 4D, projected from the
+ * camera on the W axis and moved by the model matrix, in homogeneous coordinates
+ * @param corners is an array containing the 8 rotated 4D corners of the cube, in the order of cubesIndices
+ * @param ID of the cube
+ * @param drawIndex is the draw index of the cube, which scales its W slightly
+ * @return the map
+ */
+glm::mat4 Window::getCellToWorld(const glm::vec4 *corners, VAO_ID ID, int32_t drawIndex) const {
+    /* Columns are the rotated edges and first corner of the cell, their W is replaced by the distance to the camera
+     * times the W the vertex shader gives to the cube */
+    glm::mat4 cellToProjection(corners[1] - corners[0], corners[2] - corners[0], corners[4] - corners[0], corners[0]);
+    float w = 1.0f + (drawIndex / 10000.0f);
+    for (uint8_t column = 0; column < 4; ++column) {
+        cellToProjection[column].w = w * ((column == 3 ? cameraOffset4D : 0.0f) - cellToProjection[column].w);
+    }
+    return getCubeModel(ID) * cellToProjection;
+}
+
+/**
+ * Report the meshlets culled per frame and the time culling them took, every cullingReportInterval frames
+ */
+void Window::logCulling() {
+    if (++culledFrames < cullingReportInterval) return;
+    const CullingStatistics &statistics = meshletCuller.getStatistics();
+    if (statistics.meshlets > 0) {
+        cout << "Meshlet culling: " << statistics.meshlets / culledFrames << " meshlets per frame, " << 100 * statistics.backFacing / statistics.meshlets << "% looking away and " << 100 * statistics.offScreen / statistics.meshlets << "% out of view, " << 100 * statistics.drawnTriangles / statistics.triangles << "% of the triangles drawn, " << cullingMilliseconds / culledFrames << " ms per frame" << endl;
+    }
+    meshletCuller.resetStatistics();
+    culledFrames = 0;
+    cullingMilliseconds = 0.0;
 }
 
 /**
@@ -505,14 +1274,15 @@ void Window::drawCubes() {
     /* Compute distances to origin and to camera */
     for (uint8_t i = 0; i < 8; ++i) {
         glm::vec3 centerOfMass(0.0f); glm::vec3 summedCoords(0.0f);
-        glm::vec3 pos;
-        for (uint16_t j = 0; j < (uint16_t) points[(VAO_ID) i].size(); j += 3) {
-            float *p = &(points[(VAO_ID) i][j]);
-            pos = glm::vec3(*(p + 0), *(p + 1), *(p + 2));
-            centerOfMass += pos;
-            summedCoords += glm::abs(pos);
+        const PointArrays &cubePoints = points[(VAO_ID) i];
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            const float *coordinates = cubePoints.getCoordinates(axis);
+            for (uint64_t j = 0; j < cubePoints.size(); ++j) {
+                centerOfMass[axis] += coordinates[j];
+                summedCoords[axis] += fabs(coordinates[j]);
+            }
         }
-        distances.push_back(glm::length(cameraPosition - centerOfMass / (float) points[(VAO_ID) i].size()));
+        distances.push_back(glm::length(cameraPosition - centerOfMass / (float) (3 * cubePoints.size())));
 
         /* Keep only the closest and furthest cube to origin */
         float norm = glm::length(summedCoords);
@@ -552,9 +1322,8 @@ void Window::drawCubes() {
         /* Set and push vertices color to the gpu through uniform */
         color = glm::vec4(cubesColors[(VAO_ID) index], menu.getGaugeValue((Gauges) index));
         loadUniformVec4f(programMain, "color", color);
-        loadUniform1i(programMain, "drawIndex", 4 - (int32_t) drawn);
         /* Draw from the vertex array */
-        drawVAOContents((VAO_ID) index);
+        drawVAOContents((VAO_ID) index, 4 - (int32_t) drawn);
         drawn++;
     } while (drawn < 3);
 
@@ -562,9 +1331,8 @@ void Window::drawCubes() {
     /* Set and push vertices color to the gpu through uniform */
     color = glm::vec4(cubesColors[inner], menu.getGaugeValue((Gauges) inner));
     loadUniformVec4f(programMain, "color", color);
-    loadUniform1i(programMain, "drawIndex", 4 - (int32_t) drawn);
     /* Draw from the vertex array */
-    drawVAOContents((VAO_ID) inner);
+    drawVAOContents((VAO_ID) inner, 4 - (int32_t) drawn);
     drawn++;
 
     /* Draw the second half cubes in from back to front, following the sorted indices/distances
@@ -576,9 +1344,8 @@ void Window::drawCubes() {
         /* Set and push vertices color to the gpu through uniform */
         color = glm::vec4(cubesColors[(VAO_ID) index], menu.getGaugeValue((Gauges) index));
         loadUniformVec4f(programMain, "color", color);
-        loadUniform1i(programMain, "drawIndex", 4 - (int32_t) drawn);
         /* Draw from the vertex array */
-        drawVAOContents((VAO_ID) index);
+        drawVAOContents((VAO_ID) index, 4 - (int32_t) drawn);
         drawn++;
     } while (drawn < 7);
 
@@ -586,9 +1353,9 @@ void Window::drawCubes() {
     /* Set and push vertices color to the gpu through uniform */
     color = glm::vec4(cubesColors[outer], menu.getGaugeValue((Gauges) outer));
     loadUniformVec4f(programMain, "color", color);
-    loadUniform1i(programMain, "drawIndex", 4 - (int32_t) drawn);
     /* Draw from the vertex array */
-    drawVAOContents((VAO_ID) outer);
+    drawVAOContents((VAO_ID) outer, 4 - (int32_t) drawn);
+    logCulling();
 }
 
 /**
@@ -605,6 +1372,9 @@ void Window::drawWireMesh() {
     glm::mat4 model = glm::mat4(1.0f);
     /* Push model matrix to gpu through uniform */
     loadUniformMat4f(programMain, "model", model);
+    /* Wire mesh points are already projected, lines have no face to shade flat */
+    loadUniform1i(programMain, "projectFrom4D", false);
+    loadUniform1i(programMain, "flatShading", false);
     /* Draw vertices and create fragments with triangles */
     glDrawElements(GL_LINES, (int32_t) currentIndicesCount[VAO_ID::WIRE_MESH], GL_UNSIGNED_INT, nullptr);
 }
@@ -809,6 +1579,14 @@ void Window::key_callback(GLFWwindow* window, int key, int scancode, int action,
         wire_mesh = !wire_mesh;
         menu.rotationWasModified = true;
     }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) { // toggle between CPU and GPU projection of the sponge
+        gpuProjection = !gpuProjection;
+        menu.rotationWasModified = true;
+    }
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) { // toggle flat shading, the normals aren't computed nor uploaded
+        flatShading = !flatShading;
+        menu.rotationWasModified = true;
+    }
 }
 
 /**
@@ -880,6 +1658,41 @@ void Window::waitNextFrame() const {
  * Clear allocated buffers and closes the window
  */
 void Window::close() {
+    /* Stop the sponge worker before its buffers and chunk files go away */
+    if (spongeWorker.joinable()) {
+        cancelSpongeWorker();
+        {
+            lock_guard<mutex> lock(spongeWorkerMutex);
+            spongeWorkerStopping = true;
+        }
+        spongeWorkerWakeUp.notify_one();
+        spongeWorker.join();
+        if (spongeRequestPending) {
+            auto stopped = chrono::steady_clock::now();
+            double latency = chrono::duration<double, milli>(stopped - spongeCancellationTime).count();
+            cout << "Sponge worker stopped " << latency << " ms after being cancelled" << endl;
+        }
+    }
+    if (speculationWorker.joinable()) {
+        cancelSpeculation();
+        {
+            lock_guard<mutex> lock(speculationWorkerMutex);
+            speculationWorkerStopping = true;
+        }
+        speculationWorkerWakeUp.notify_one();
+        speculationWorker.join();
+    }
+    if (projectionWorker.joinable()) {
+        {
+            lock_guard<mutex> lock(projectionWorkerMutex);
+            projectionWorkerStopping = true;
+        }
+        projectionWorkerWakeUp.notify_one();
+        projectionWorker.join();
+    }
+    releaseChunks();
+    chunkStore->close();
+    nextChunkStore->close();
     /* Deallocate vertex arrays and buffer */
     glDeleteVertexArrays(VAO_ID::NUMBER, VAO);
     glDeleteBuffers(VAO_ID::NUMBER, VBO);